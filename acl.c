@@ -0,0 +1,557 @@
+#define _GNU_SOURCE
+#include "acl.h"
+#include "parent.h"
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct rule
+{
+	struct rule *next;
+	unsigned short lo, hi;
+	enum acl_verdict action;
+	struct parent *via;
+};
+
+/* node of a path compressed binary trie, holding the rules for the
+   prefix key/plen. nodes without rules only exist to branch. */
+struct rnode
+{
+	struct rnode *child[2];
+	struct rule *rules;
+	unsigned char plen;
+	unsigned char key[16];
+};
+
+/* domain suffix trie, keyed by (parent, label) in one hash table, so a
+   lookup costs one probe per label of the requested name. */
+struct dnode
+{
+	struct dnode *parent;
+	struct rule *rules;
+	unsigned char len;
+	char label[];
+};
+
+struct acl
+{
+	unsigned refs;
+	struct rnode *v4, *v6;
+	struct dnode **dtab;
+	size_t dcap, dcount;
+	struct rule *any;
+	enum acl_verdict def;
+	unsigned ncidr, ndomain, nany;
+};
+
+static const char *rules_path;
+static struct acl *active;
+static pthread_mutex_t active_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long denied, reloads;
+
+static int bit(const unsigned char *key, unsigned i)
+{
+	return (key[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+static unsigned common_bits(const unsigned char *a, const unsigned char *b, unsigned max)
+{
+	unsigned i = 0;
+	while (i < max && a[i >> 3] == b[i >> 3])
+		i += 8;
+	if (i < max)
+		i += __builtin_clz((a[i >> 3] ^ b[i >> 3]) << 24);
+	return i < max ? i : max;
+}
+
+static int prefix_match(const unsigned char *prefix, const unsigned char *key, unsigned plen)
+{
+	unsigned n = plen >> 3, rest = plen & 7;
+	if (memcmp(prefix, key, n))
+		return 0;
+	return !rest || !((prefix[n] ^ key[n]) & (0xff << (8 - rest)));
+}
+
+static struct rnode *rnode_new(const unsigned char *key, unsigned plen)
+{
+	struct rnode *n = calloc(1, sizeof *n);
+	if (!n)
+		return 0;
+	n->plen = plen;
+	memcpy(n->key, key, (plen + 7) >> 3);
+	if (plen & 7)
+		n->key[plen >> 3] &= 0xff << (8 - (plen & 7));
+	return n;
+}
+
+static struct rnode *radix_insert(struct rnode **link, const unsigned char *key, unsigned plen)
+{
+	struct rnode *n, *m, *glue;
+	while ((n = *link))
+	{
+		unsigned common = common_bits(n->key, key, n->plen < plen ? n->plen : plen);
+		if (common == n->plen)
+		{
+			if (n->plen == plen)
+				return n;
+			link = &n->child[bit(key, n->plen)];
+			continue;
+		}
+		if (!(m = rnode_new(key, plen)))
+			return 0;
+		if (common == plen)
+		{
+			/* the new prefix contains n */
+			m->child[bit(n->key, plen)] = n;
+			return *link = m;
+		}
+		if (!(glue = rnode_new(key, common)))
+		{
+			free(m);
+			return 0;
+		}
+		glue->child[bit(key, common)] = m;
+		glue->child[bit(n->key, common)] = n;
+		*link = glue;
+		return m;
+	}
+	return *link = rnode_new(key, plen);
+}
+
+static void radix_free(struct rnode *n);
+
+static void rules_free(struct rule *r)
+{
+	struct rule *next;
+	for (; r; r = next)
+	{
+		next = r->next;
+		free(r);
+	}
+}
+
+static void radix_free(struct rnode *n)
+{
+	if (!n)
+		return;
+	radix_free(n->child[0]);
+	radix_free(n->child[1]);
+	rules_free(n->rules);
+	free(n);
+}
+
+static const struct rule *rules_match(const struct rule *r, unsigned short port)
+{
+	for (; r; r = r->next)
+		if (port >= r->lo && port <= r->hi)
+			return r;
+	return 0;
+}
+
+static const struct rule *radix_match(const struct rnode *n, const unsigned char *key, unsigned bits, unsigned short port)
+{
+	const struct rnode *path[129];
+	unsigned depth = 0;
+	const struct rule *r = 0;
+	while (n && prefix_match(n->key, key, n->plen))
+	{
+		if (n->rules)
+			path[depth++] = n;
+		if (n->plen == bits)
+			break;
+		n = n->child[bit(key, n->plen)];
+	}
+	while (depth && !r)
+		r = rules_match(path[--depth]->rules, port);
+	return r;
+}
+
+static size_t dhash(const struct dnode *parent, const char *label, size_t len)
+{
+	uint64_t h = (uintptr_t)parent * 0x9e3779b97f4a7c15ull;
+	while (len--)
+		h = (h ^ (unsigned char)*label++) * 0x100000001b3ull;
+	return h ^ (h >> 29);
+}
+
+static struct dnode **dslot(struct acl *a, const struct dnode *parent, const char *label, size_t len)
+{
+	size_t mask = a->dcap - 1, i = dhash(parent, label, len) & mask;
+	struct dnode *n;
+	while ((n = a->dtab[i]))
+	{
+		if (n->parent == parent && n->len == len && !memcmp(n->label, label, len))
+			break;
+		i = (i + 1) & mask;
+	}
+	return &a->dtab[i];
+}
+
+static int dgrow(struct acl *a)
+{
+	struct dnode **old = a->dtab;
+	size_t i, oldcap = a->dcap;
+	a->dcap = oldcap ? oldcap * 2 : 256;
+	if (!(a->dtab = calloc(a->dcap, sizeof *a->dtab)))
+	{
+		a->dtab = old;
+		a->dcap = oldcap;
+		return -1;
+	}
+	for (i = 0; i < oldcap; i++)
+		if (old[i])
+			*dslot(a, old[i]->parent, old[i]->label, old[i]->len) = old[i];
+	free(old);
+	return 0;
+}
+
+static struct dnode *dnode_get(struct acl *a, struct dnode *parent, const char *label, size_t len)
+{
+	struct dnode **slot, *n;
+	if (2 * (a->dcount + 1) > a->dcap && dgrow(a))
+		return 0;
+	slot = dslot(a, parent, label, len);
+	if (*slot)
+		return *slot;
+	if (!(n = calloc(1, sizeof *n + len)))
+		return 0;
+	n->parent = parent;
+	n->len = len;
+	memcpy(n->label, label, len);
+	a->dcount++;
+	return *slot = n;
+}
+
+/* lowercase name into buf without a trailing dot, returns its length */
+static size_t normalize(char *buf, const char *name)
+{
+	size_t len = 0;
+	while (name[len] && len < 255)
+	{
+		buf[len] = tolower((unsigned char)name[len]);
+		len++;
+	}
+	if (len && buf[len - 1] == '.')
+		len--;
+	buf[len] = 0;
+	return len;
+}
+
+static const struct rule *domain_match(struct acl *a, const char *name, unsigned short port)
+{
+	const struct dnode *path[128];
+	struct dnode *n = 0, **slot;
+	unsigned depth = 0;
+	const struct rule *r = 0;
+	char buf[256];
+	size_t end = normalize(buf, name), start;
+	if (!a->dcount)
+		return 0;
+	while (end > 0 && depth < 128)
+	{
+		for (start = end; start > 0 && buf[start - 1] != '.'; start--)
+			;
+		slot = dslot(a, n, buf + start, end - start);
+		if (!(n = *slot))
+			break;
+		if (n->rules)
+			path[depth++] = n;
+		end = start ? start - 1 : 0;
+	}
+	while (depth && !r)
+		r = rules_match(path[--depth]->rules, port);
+	return r;
+}
+
+static void acl_free(struct acl *a)
+{
+	size_t i;
+	radix_free(a->v4);
+	radix_free(a->v6);
+	for (i = 0; i < a->dcap; i++)
+	{
+		if (!a->dtab[i])
+			continue;
+		rules_free(a->dtab[i]->rules);
+		free(a->dtab[i]);
+	}
+	free(a->dtab);
+	rules_free(a->any);
+	free(a);
+}
+
+/* append rules for all port ranges in ports to *list, keeping file order */
+static int add_rules(struct rule **list, enum acl_verdict action, struct parent *via, char *ports)
+{
+	char *range, *save, *end, all[] = "0-65535";
+	unsigned long lo, hi;
+	while (*list)
+		list = &(*list)->next;
+	if (!ports)
+		ports = all;
+	for (range = strtok_r(ports, ",", &save); range; range = strtok_r(0, ",", &save))
+	{
+		lo = hi = strtoul(range, &end, 10);
+		if (*end == '-')
+			hi = strtoul(end + 1, &end, 10);
+		if (end == range || *end || lo > hi || hi > 65535)
+			return -1;
+		if (!(*list = calloc(1, sizeof **list)))
+			return -1;
+		(*list)->lo = lo;
+		(*list)->hi = hi;
+		(*list)->action = action;
+		(*list)->via = via;
+		list = &(*list)->next;
+	}
+	return 0;
+}
+
+static struct rule **cidr_rules(struct acl *a, char *target)
+{
+	unsigned char key[16];
+	char *slash = strchr(target, '/'), *end;
+	unsigned long plen, bits = 32;
+	struct rnode *n;
+	if (slash)
+		*slash = 0;
+	if (inet_pton(AF_INET, target, key) != 1)
+	{
+		if (inet_pton(AF_INET6, target, key) != 1)
+			return 0;
+		bits = 128;
+	}
+	plen = bits;
+	if (slash && ((plen = strtoul(slash + 1, &end, 10)) > bits || end == slash + 1 || *end))
+		return 0;
+	if (!(n = radix_insert(bits == 32 ? &a->v4 : &a->v6, key, plen)))
+		return 0;
+	a->ncidr++;
+	return &n->rules;
+}
+
+static struct rule **domain_rules(struct acl *a, const char *target)
+{
+	char buf[256];
+	size_t end, start;
+	struct dnode *n = 0;
+	if (!strncmp(target, "*.", 2))
+		target += 2;
+	else if (*target == '.')
+		target++;
+	end = normalize(buf, target);
+	if (!end)
+		return 0;
+	while (end > 0)
+	{
+		for (start = end; start > 0 && buf[start - 1] != '.'; start--)
+			;
+		if (start == end || !(n = dnode_get(a, n, buf + start, end - start)))
+			return 0;
+		end = start ? start - 1 : 0;
+	}
+	a->ndomain++;
+	return &n->rules;
+}
+
+static int is_cidr(const char *target)
+{
+	unsigned char tmp[4];
+	char buf[64];
+	size_t len = strcspn(target, "/");
+	if (strchr(target, ':'))
+		return 1;
+	if (len >= sizeof buf)
+		return 0;
+	memcpy(buf, target, len);
+	buf[len] = 0;
+	return inet_pton(AF_INET, buf, tmp) == 1;
+}
+
+static struct acl *acl_load(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[1024], *save, *word[5], **arg;
+	unsigned lineno = 0, nwords;
+	struct acl *a;
+	struct rule **list;
+	struct parent *via;
+	enum acl_verdict action;
+	if (!f)
+	{
+		perror(path);
+		return 0;
+	}
+	if (!(a = calloc(1, sizeof *a)))
+		goto fail;
+	a->def = ACL_ALLOW;
+	while (fgets(line, sizeof line, f))
+	{
+		lineno++;
+		line[strcspn(line, "#\r\n")] = 0;
+		nwords = 0;
+		for (word[0] = strtok_r(line, " \t", &save); word[nwords] && nwords < 4;)
+			word[++nwords] = strtok_r(0, " \t", &save);
+		if (!nwords)
+			continue;
+		arg = word + 1;
+		via = 0;
+		if (!strcmp(word[0], "allow"))
+			action = ACL_ALLOW;
+		else if (!strcmp(word[0], "deny"))
+			action = ACL_DENY;
+		else if (!strcmp(word[0], "via") && nwords > 2 && (via = parent_find(word[1])))
+		{
+			action = ACL_ALLOW;
+			arg++;
+		}
+		else if (!strcmp(word[0], "default") && nwords == 2 &&
+				 (!strcmp(word[1], "allow") || !strcmp(word[1], "deny")))
+		{
+			a->def = word[1][0] == 'a' ? ACL_ALLOW : ACL_DENY;
+			continue;
+		}
+		else
+			goto bad;
+		/* at most a target and ports after the action */
+		if (nwords < 2 || word[nwords] || arg + 2 < word + nwords)
+			goto bad;
+		if (!strcmp(arg[0], "*"))
+		{
+			list = &a->any;
+			a->nany++;
+		}
+		else
+			list = is_cidr(arg[0]) ? cidr_rules(a, arg[0]) : domain_rules(a, arg[0]);
+		if (!list || add_rules(list, action, via, arg[1]))
+			goto bad;
+	}
+	fclose(f);
+	return a;
+bad:
+	dprintf(2, "%s:%u: invalid rule\n", path, lineno);
+fail:
+	fclose(f);
+	if (a)
+		acl_free(a);
+	return 0;
+}
+
+static int install(const char *path)
+{
+	struct acl *a = acl_load(path), *old;
+	if (!a)
+		return -1;
+	a->refs = 1;
+	pthread_mutex_lock(&active_mutex);
+	old = active;
+	__atomic_store_n(&active, a, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&active_mutex);
+	acl_release(old);
+	return 0;
+}
+
+int acl_config(const char *path)
+{
+	if (install(path))
+		return -1;
+	rules_path = path;
+	return 0;
+}
+
+int acl_reload(void)
+{
+	if (!rules_path)
+		return 0;
+	if (install(rules_path))
+		return -1;
+	__atomic_add_fetch(&reloads, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+struct acl *acl_acquire(void)
+{
+	struct acl *a;
+	if (!__atomic_load_n(&active, __ATOMIC_ACQUIRE))
+		return 0;
+	pthread_mutex_lock(&active_mutex);
+	if ((a = active))
+		__atomic_add_fetch(&a->refs, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&active_mutex);
+	return a;
+}
+
+void acl_release(struct acl *a)
+{
+	if (a && !__atomic_sub_fetch(&a->refs, 1, __ATOMIC_ACQ_REL))
+		acl_free(a);
+}
+
+static enum acl_verdict judged(const struct rule *r, enum acl_verdict def, struct parent **via)
+{
+	enum acl_verdict v = r ? r->action : def;
+	*via = r ? r->via : 0;
+	if (v == ACL_DENY)
+		__atomic_add_fetch(&denied, 1, __ATOMIC_RELAXED);
+	return v;
+}
+
+enum acl_verdict acl_check_addr(struct acl *a, const struct sockaddr *sa, unsigned short port, struct parent **via)
+{
+	const unsigned char *key;
+	const struct rule *r = 0;
+	if (sa->sa_family == AF_INET)
+	{
+		key = (const void *)&((const struct sockaddr_in *)sa)->sin_addr;
+		r = radix_match(a->v4, key, 32, port);
+	}
+	else if (sa->sa_family == AF_INET6)
+	{
+		key = ((const struct sockaddr_in6 *)sa)->sin6_addr.s6_addr;
+		if (IN6_IS_ADDR_V4MAPPED((const struct in6_addr *)key))
+			r = radix_match(a->v4, key + 12, 32, port);
+		else
+			r = radix_match(a->v6, key, 128, port);
+	}
+	if (!r)
+		r = rules_match(a->any, port);
+	return judged(r, a->def, via);
+}
+
+enum acl_verdict acl_check_name(struct acl *a, const char *name, unsigned short port, struct parent **via)
+{
+	union
+	{
+		struct sockaddr sa;
+		struct sockaddr_in v4;
+		struct sockaddr_in6 v6;
+	} addr = {0};
+	if (inet_pton(AF_INET, name, &addr.v4.sin_addr) == 1)
+	{
+		addr.sa.sa_family = AF_INET;
+		return acl_check_addr(a, &addr.sa, port, via);
+	}
+	if (inet_pton(AF_INET6, name, &addr.v6.sin6_addr) == 1)
+	{
+		addr.sa.sa_family = AF_INET6;
+		return acl_check_addr(a, &addr.sa, port, via);
+	}
+	return judged(domain_match(a, name, port), ACL_NONE, via);
+}
+
+void acl_dump(int fd)
+{
+	struct acl *a = acl_acquire();
+	if (!a)
+		return;
+	dprintf(fd, "acl: %u cidr, %u domain, %u wildcard rules, default %s, %llu denied, %llu reloads\n",
+			a->ncidr, a->ndomain, a->nany, a->def == ACL_DENY ? "deny" : "allow",
+			__atomic_load_n(&denied, __ATOMIC_RELAXED),
+			__atomic_load_n(&reloads, __ATOMIC_RELAXED));
+	acl_release(a);
+}
@@ -0,0 +1,51 @@
+#ifndef ACL_H
+#define ACL_H
+
+#include <sys/socket.h>
+
+//RcB: DEP "acl.c"
+
+/* destination access control. rules are read from a file, one per line:
+
+     allow|deny TARGET [PORTS]
+     via PARENT TARGET [PORTS]
+     default allow|deny
+
+   TARGET is a cidr (10.0.0.0/8, 2001:db8::/32, a bare address), a domain
+   (example.com also matches all its subdomains, a leading "*." or "." is
+   optional), or "*" for any destination. PORTS is a comma separated list
+   of ports and lo-hi ranges, all ports if omitted. "via" allows the
+   destination and routes it through the named parent proxy.
+   the most specific target wins, i.e. the longest matching prefix or
+   domain suffix, and among the rules for the same target the first one
+   whose ports match. "*" rules are consulted last, then the default,
+   which is allow unless set otherwise.
+   a hostname without a matching domain rule is judged by the address it
+   resolves to. */
+
+enum acl_verdict
+{
+	ACL_NONE,
+	ACL_ALLOW,
+	ACL_DENY,
+};
+
+struct acl;
+struct parent;
+
+/* load the rules from path and make them the active rule set.
+   returns 0 on success, otherwise the active rules stay in place. */
+int acl_config(const char *path);
+/* load the file given to acl_config() again */
+int acl_reload(void);
+/* the active rule set with a reference held, or NULL if there is none */
+struct acl *acl_acquire(void);
+void acl_release(struct acl *acl);
+/* verdict for a requested hostname or address literal. returns ACL_NONE
+   for a hostname no domain rule applies to, acl_check_addr() then decides
+   once it is resolved. *via is set to the parent proxy to use, if any. */
+enum acl_verdict acl_check_name(struct acl *acl, const char *name, unsigned short port, struct parent **via);
+enum acl_verdict acl_check_addr(struct acl *acl, const struct sockaddr *sa, unsigned short port, struct parent **via);
+void acl_dump(int fd);
+
+#endif
@@ -0,0 +1,76 @@
+#define _GNU_SOURCE
+#include "admin.h"
+#include "server.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+static admin_handler handler;
+static int listenfd = -1;
+
+static void *admin_thread(void *data)
+{
+	int lfd = (long)data, fd;
+	char cmd[128];
+	struct timeval timeo = {.tv_sec = 1};
+	for (;;)
+	{
+		if ((fd = accept4(lfd, 0, 0, SOCK_CLOEXEC)) == -1)
+		{
+			/* the listener itself is gone, nothing will ever come */
+			if (errno == EBADF || errno == ENOTSOCK)
+				break;
+			/* admin_stop() shut it down, free the name for the next instance */
+			if (errno == EINVAL)
+			{
+				close(lfd);
+				break;
+			}
+			/* out of fds or memory, give the sessions a moment to free some */
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+				usleep(100000);
+			continue;
+		}
+		if (!unix_peer_ours(fd))
+		{
+			close(fd);
+			continue;
+		}
+		/* a client that sends nothing gets the default report, one that
+		   doesn't read it can't stall the thread either */
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeo, sizeof timeo);
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeo, sizeof timeo);
+		ssize_t n = read(fd, cmd, sizeof cmd - 1);
+		cmd[n > 0 ? n : 0] = 0;
+		cmd[strcspn(cmd, "\r\n")] = 0;
+		handler(fd, cmd);
+		close(fd);
+	}
+	return 0;
+}
+
+int admin_start(const char *path, admin_handler h)
+{
+	pthread_t pt;
+	int fd = unix_listen(path, 16, 0600);
+	if (fd == -1)
+		return -1;
+	handler = h;
+	listenfd = fd;
+	if (pthread_create(&pt, 0, admin_thread, (void *)(long)fd))
+	{
+		close(fd);
+		return -1;
+	}
+	pthread_detach(pt);
+	return 0;
+}
+
+void admin_stop(void)
+{
+	if (listenfd != -1)
+		shutdown(listenfd, SHUT_RDWR);
+	listenfd = -1;
+}
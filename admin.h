@@ -0,0 +1,18 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+//RcB: DEP "admin.c"
+
+/* read-only admin endpoint on a unix socket. a client sends one command
+   line, e.g. "stats", and gets the text report back, then the connection
+   is closed: echo workers | nc -U /run/microsocks.admin */
+
+typedef void (*admin_handler)(int fd, const char *cmd);
+
+/* listen on path and serve every request with h from a thread of its own.
+   returns 0 on success. */
+int admin_start(const char *path, admin_handler h);
+/* stop serving and release path, e.g. for the instance taking over */
+void admin_stop(void);
+
+#endif
@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+#include "admission.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IP_BUCKETS 4096
+
+struct ipcount
+{
+	struct ipcount *next;
+	size_t len;
+	unsigned char ip[16];
+	unsigned count;
+};
+
+static unsigned max_sessions, max_per_ip, max_handshakes;
+static unsigned sessions, handshakes;
+static unsigned long long accepted, shed[ADM_HANDSHAKES + 1];
+
+static struct ipcount *ip_table[IP_BUCKETS];
+static pthread_mutex_t ip_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int admission_config(char *opts)
+{
+	char *const keys[] = {"sessions", "perip", "handshakes", 0};
+	unsigned *const vals[] = {&max_sessions, &max_per_ip, &max_handshakes};
+	char *value;
+	while (*opts)
+	{
+		int i = getsubopt(&opts, keys, &value);
+		if (i < 0 || !value)
+			return -1;
+		*vals[i] = strtoul(value, 0, 10);
+	}
+	return 0;
+}
+
+static unsigned ip_hash(const unsigned char *ip, size_t len)
+{
+	unsigned h = 2166136261u;
+	while (len--)
+		h = (h ^ *ip++) * 16777619u;
+	return h % IP_BUCKETS;
+}
+
+/* adjust the session count of addr by delta, returns the new count.
+   when incrementing beyond limit the count is left untouched. */
+static unsigned ip_adjust(const union sockaddr_union *addr, int delta, unsigned limit)
+{
+	size_t len;
+	const unsigned char *ip = sockaddr_ip(addr, &len);
+	struct ipcount **pp, *e;
+	unsigned ret = 0;
+	pthread_mutex_lock(&ip_mutex);
+	for (pp = &ip_table[ip_hash(ip, len)]; (e = *pp); pp = &e->next)
+		if (e->len == len && !memcmp(e->ip, ip, len))
+			break;
+	if (delta > 0)
+	{
+		if (!e && (e = calloc(1, sizeof *e)))
+		{
+			e->len = len;
+			memcpy(e->ip, ip, len);
+			*pp = e;
+		}
+		if (!e)
+			ret = limit + 1; /* OOM, shed */
+		else if (e->count < limit)
+			ret = ++e->count;
+		else
+			ret = limit + 1;
+	}
+	else if (e && !(ret = --e->count))
+	{
+		*pp = e->next;
+		free(e);
+	}
+	pthread_mutex_unlock(&ip_mutex);
+	return ret;
+}
+
+enum admission admission_enter(const union sockaddr_union *addr)
+{
+	enum admission ret = ADM_OK;
+	__atomic_add_fetch(&accepted, 1, __ATOMIC_RELAXED);
+	if (max_sessions && __atomic_load_n(&sessions, __ATOMIC_RELAXED) >= max_sessions)
+		ret = ADM_SESSIONS;
+	else if (max_handshakes && __atomic_load_n(&handshakes, __ATOMIC_RELAXED) >= max_handshakes)
+		ret = ADM_HANDSHAKES;
+	else if (max_per_ip && ip_adjust(addr, 1, max_per_ip) > max_per_ip)
+		ret = ADM_PER_IP;
+	if (ret != ADM_OK)
+	{
+		__atomic_add_fetch(&shed[ret], 1, __ATOMIC_RELAXED);
+		return ret;
+	}
+	__atomic_add_fetch(&sessions, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&handshakes, 1, __ATOMIC_RELAXED);
+	return ADM_OK;
+}
+
+void admission_established(void)
+{
+	__atomic_sub_fetch(&handshakes, 1, __ATOMIC_RELAXED);
+}
+
+void admission_leave(const union sockaddr_union *addr, int handshaking)
+{
+	if (handshaking)
+		admission_established();
+	__atomic_sub_fetch(&sessions, 1, __ATOMIC_RELAXED);
+	if (max_per_ip)
+		ip_adjust(addr, -1, 0);
+}
+
+void admission_dump(int fd)
+{
+	dprintf(fd, "sessions: %u/%u handshakes: %u/%u accepted: %llu\n"
+				"shed: sessions %llu perip %llu (limit %u) handshakes %llu\n",
+			__atomic_load_n(&sessions, __ATOMIC_RELAXED), max_sessions,
+			__atomic_load_n(&handshakes, __ATOMIC_RELAXED), max_handshakes,
+			__atomic_load_n(&accepted, __ATOMIC_RELAXED),
+			__atomic_load_n(&shed[ADM_SESSIONS], __ATOMIC_RELAXED),
+			__atomic_load_n(&shed[ADM_PER_IP], __ATOMIC_RELAXED), max_per_ip,
+			__atomic_load_n(&shed[ADM_HANDSHAKES], __ATOMIC_RELAXED));
+}
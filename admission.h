@@ -0,0 +1,30 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include "server.h"
+
+//RcB: DEP "admission.c"
+
+/* admission control: caps on concurrent sessions, sessions per source ip
+   and sessions which have not finished their socks handshake yet.
+   connections over a cap are shed right after accept, before any
+   memory or thread is spent on them. */
+
+enum admission
+{
+	ADM_OK = 0,
+	ADM_SESSIONS,
+	ADM_PER_IP,
+	ADM_HANDSHAKES,
+};
+
+/* parse a getsubopt(3) list like "sessions=N,perip=N,handshakes=N".
+   a limit of 0 means unlimited. returns 0 on success. */
+int admission_config(char *opts);
+enum admission admission_enter(const union sockaddr_union *addr);
+/* the session finished its handshake and starts relaying */
+void admission_established(void);
+void admission_leave(const union sockaddr_union *addr, int handshaking);
+void admission_dump(int fd);
+
+#endif
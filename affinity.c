@@ -0,0 +1,74 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+static int cpus[CPU_SETSIZE];
+static unsigned ncpus;
+static cpu_set_t set;
+
+int affinity_config(const char *list)
+{
+	char *end;
+	unsigned long lo, hi;
+	while (*list)
+	{
+		lo = hi = strtoul(list, &end, 10);
+		if (*end == '-')
+			hi = strtoul(end + 1, &end, 10);
+		if (end == list || lo > hi || hi >= CPU_SETSIZE || (*end && *end != ','))
+			return -1;
+		for (; lo <= hi; lo++)
+		{
+			if (CPU_ISSET(lo, &set))
+				continue;
+			CPU_SET(lo, &set);
+			cpus[ncpus++] = lo;
+		}
+		list = *end ? end + 1 : end;
+	}
+	return ncpus ? 0 : -1;
+}
+
+int affinity_enabled(void)
+{
+	return ncpus != 0;
+}
+
+unsigned affinity_count(void)
+{
+	return ncpus;
+}
+
+int affinity_cpu(unsigned i)
+{
+	return cpus[i % ncpus];
+}
+
+int affinity_has(int cpu)
+{
+	return cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &set);
+}
+
+int affinity_pin_self(int cpu)
+{
+	cpu_set_t one;
+	if (cpu < 0)
+		return pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+	CPU_ZERO(&one);
+	CPU_SET(cpu, &one);
+	return pthread_setaffinity_np(pthread_self(), sizeof one, &one);
+}
+
+int affinity_incoming_cpu(int fd)
+{
+#ifdef SO_INCOMING_CPU
+	int cpu;
+	socklen_t len = sizeof cpu;
+	if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0)
+		return cpu;
+#endif
+	return -1;
+}
@@ -0,0 +1,27 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+//RcB: DEP "affinity.c"
+
+/* cpu placement. with a cpu list configured, the accept loop runs on
+   those cpus, coroutine worker i is pinned to the i-th of them, and a new
+   session is handed to the worker (or, with session threads, pinned to
+   the cpu) on which the kernel processed its connection, so the packets,
+   the socket buffers and the relay share one cache and numa node.
+   memory is placed by first touch: stacks and buffers are only touched
+   by the worker that uses them. */
+
+/* parse a cpu list like "0-7,16-23". returns 0 on success. */
+int affinity_config(const char *list);
+int affinity_enabled(void);
+unsigned affinity_count(void);
+/* the i-th configured cpu */
+int affinity_cpu(unsigned i);
+/* nonzero if cpu is one of the configured cpus */
+int affinity_has(int cpu);
+/* pin the calling thread to cpu, or to all configured cpus for -1 */
+int affinity_pin_self(int cpu);
+/* the cpu which processed the packets of the connection on fd, or -1 */
+int affinity_incoming_cpu(int fd);
+
+#endif
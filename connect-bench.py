@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+# latency of tunnel setup under many simultaneous CONNECTs, e.g.
+#   ./microsocks -p 1080 & ./connect-bench.py 1080 200
+# or with every CONNECT taking 200ms at a parent proxy this script runs:
+#   printf 'via slow *\n' > via.acl
+#   ./microsocks -p 1081 -U slow=socks5://127.0.0.1:1090 -A via.acl &
+#   ./connect-bench.py 1081 200 1090 200
+# N clients open their tunnels to a target of their own on 127.0.0.1 at the
+# same time, each one is timed from its tcp connect to the proxy's reply.
+# setup that runs concurrently keeps the slowest close to the fastest, one
+# that is serialised somewhere grows with N times the parent's delay.
+import socket, struct, sys, threading, time
+
+def listen(port=0):
+	s = socket.socket()
+	s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+	s.bind(('127.0.0.1', port))
+	s.listen(1024)
+	return s
+
+def serve(ls, handler):
+	def run():
+		while True:
+			c, _ = ls.accept()
+			threading.Thread(target=handler, args=(c,), daemon=True).start()
+	threading.Thread(target=run, daemon=True).start()
+	return ls.getsockname()[1]
+
+def target(c):
+	c.recv(1)
+	c.close()
+
+def relay(a, b):
+	try:
+		while True:
+			d = a.recv(65536)
+			if not d:
+				break
+			b.sendall(d)
+		b.shutdown(socket.SHUT_WR)
+	except OSError:
+		pass
+
+def parent(delay):
+	def handle(c):
+		c.recv(16)
+		c.sendall(b'\5\0')
+		r = c.recv(512)
+		if r[3] == 1:
+			host, port = socket.inet_ntoa(r[4:8]), struct.unpack('>H', r[8:10])[0]
+		else:
+			l = r[4]
+			host, port = r[5:5 + l].decode(), struct.unpack('>H', r[5 + l:7 + l])[0]
+		time.sleep(delay)
+		u = socket.create_connection((host, port))
+		c.sendall(b'\5\0\0\1\0\0\0\0\0\0')
+		threading.Thread(target=relay, args=(u, c), daemon=True).start()
+		relay(c, u)
+	return handle
+
+def connect(port, dst, lat, i):
+	t = time.monotonic()
+	try:
+		s = socket.create_connection(('127.0.0.1', port))
+		s.sendall(b'\5\1\0')
+		s.recv(2)
+		s.sendall(b'\5\1\0\1' + socket.inet_aton('127.0.0.1') + struct.pack('>H', dst))
+		r = s.recv(10)
+		if len(r) > 1 and r[1] == 0:
+			lat[i] = (time.monotonic() - t) * 1000
+		s.close()
+	except OSError:
+		pass
+
+def main():
+	if len(sys.argv) < 2:
+		sys.exit('usage: %s proxyport [N] [parentport] [delay_ms]' % sys.argv[0])
+	proxy = int(sys.argv[1])
+	n = int(sys.argv[2]) if len(sys.argv) > 2 else 100
+	if len(sys.argv) > 3:
+		delay = int(sys.argv[4]) if len(sys.argv) > 4 else 200
+		serve(listen(int(sys.argv[3])), parent(delay / 1000))
+	dst = serve(listen(), target)
+	lat = [None] * n
+	th = [threading.Thread(target=connect, args=(proxy, dst, lat, i)) for i in range(n)]
+	t = time.monotonic()
+	for x in th:
+		x.start()
+	for x in th:
+		x.join()
+	t = time.monotonic() - t
+	ok = sorted(l for l in lat if l is not None)
+	if not ok:
+		sys.exit('no tunnel was set up')
+	print('%d connects, %d ok, p50 %.0f ms, p90 %.0f ms, max %.0f ms, wall %.2f s' %
+		  (n, len(ok), ok[len(ok) // 2], ok[len(ok) * 9 // 10], ok[-1], t))
+
+main()
@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+#include "coro.h"
+#include "affinity.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if CONFIG_CORO
+#include <pthread.h>
+#include <stdint.h>
+#include <ucontext.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+/* number of unused stacks per worker kept around to avoid mmap churn */
+#define STACK_CACHE 64
+#define NO_HEAP ((size_t)-1)
+
+struct coro
+{
+	ucontext_t ctx;
+	void *(*fn)(void *);
+	void *arg;
+	char *stack;
+	struct coro *next;
+	long long deadline;
+	size_t heapidx;
+	int queued;
+	int timedout;
+	int done;
+};
+
+struct worker
+{
+	pthread_t pt;
+	int cpu;
+	int epfd;
+	int evfd;
+	ucontext_t sched;
+	struct coro *current;
+	struct coro *runq, *runq_tail;
+	/* coroutines handed over by coro_spawn(), protected by inbox_mutex */
+	pthread_mutex_t inbox_mutex;
+	struct coro *inbox;
+	/* min-heap of coroutines waiting with a timeout, ordered by deadline */
+	struct coro **heap;
+	size_t heapcount, heapcapa;
+	/* stacks are cached per worker, so their pages stay on its numa node */
+	pthread_mutex_t stack_mutex;
+	char *stack_cache[STACK_CACHE];
+	size_t stack_cached;
+};
+
+static struct worker *workers;
+static unsigned nworkers;
+static unsigned spawn_rr;
+static size_t stacksize, pagesize;
+static __thread struct worker *self;
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* stacks are reserved with MAP_NORESERVE, so only the pages a session
+   actually touches count towards RSS, and they are first touched by the
+   worker running it. the lowest page is the guard. */
+static char *stack_get(struct worker *w)
+{
+	char *s = 0;
+	pthread_mutex_lock(&w->stack_mutex);
+	if (w->stack_cached)
+		s = w->stack_cache[--w->stack_cached];
+	pthread_mutex_unlock(&w->stack_mutex);
+	if (s)
+		return s;
+	s = mmap(0, pagesize + stacksize, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if (s == MAP_FAILED)
+		return 0;
+	if (mprotect(s, pagesize, PROT_NONE))
+	{
+		munmap(s, pagesize + stacksize);
+		return 0;
+	}
+	return s;
+}
+
+static void stack_put(struct worker *w, char *s)
+{
+	pthread_mutex_lock(&w->stack_mutex);
+	if (w->stack_cached < STACK_CACHE)
+	{
+		w->stack_cache[w->stack_cached++] = s;
+		s = 0;
+	}
+	pthread_mutex_unlock(&w->stack_mutex);
+	if (s)
+		munmap(s, pagesize + stacksize);
+}
+
+static void heap_swap(struct worker *w, size_t a, size_t b)
+{
+	struct coro *tmp = w->heap[a];
+	w->heap[a] = w->heap[b];
+	w->heap[b] = tmp;
+	w->heap[a]->heapidx = a;
+	w->heap[b]->heapidx = b;
+}
+
+static void heap_up(struct worker *w, size_t i)
+{
+	while (i && w->heap[(i - 1) / 2]->deadline > w->heap[i]->deadline)
+	{
+		heap_swap(w, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void heap_down(struct worker *w, size_t i)
+{
+	for (;;)
+	{
+		size_t l = 2 * i + 1, r = l + 1, m = i;
+		if (l < w->heapcount && w->heap[l]->deadline < w->heap[m]->deadline)
+			m = l;
+		if (r < w->heapcount && w->heap[r]->deadline < w->heap[m]->deadline)
+			m = r;
+		if (m == i)
+			return;
+		heap_swap(w, i, m);
+		i = m;
+	}
+}
+
+static int heap_push(struct worker *w, struct coro *c)
+{
+	if (w->heapcount == w->heapcapa)
+	{
+		size_t capa = w->heapcapa ? w->heapcapa * 2 : 64;
+		struct coro **tmp = realloc(w->heap, capa * sizeof *tmp);
+		if (!tmp)
+			return -1;
+		w->heap = tmp;
+		w->heapcapa = capa;
+	}
+	c->heapidx = w->heapcount;
+	w->heap[w->heapcount++] = c;
+	heap_up(w, c->heapidx);
+	return 0;
+}
+
+static void heap_remove(struct worker *w, struct coro *c)
+{
+	size_t i = c->heapidx;
+	c->heapidx = NO_HEAP;
+	if (--w->heapcount == i)
+		return;
+	w->heap[i] = w->heap[w->heapcount];
+	w->heap[i]->heapidx = i;
+	heap_up(w, i);
+	heap_down(w, w->heap[i]->heapidx);
+}
+
+static void enqueue(struct worker *w, struct coro *c)
+{
+	if (c->queued)
+		return;
+	c->queued = 1;
+	c->next = 0;
+	if (w->runq_tail)
+		w->runq_tail->next = c;
+	else
+		w->runq = c;
+	w->runq_tail = c;
+}
+
+static void trampoline(void)
+{
+	struct coro *c = self->current;
+	c->fn(c->arg);
+	c->done = 1;
+}
+
+static void *worker_main(void *data)
+{
+	struct worker *w = data;
+	struct epoll_event evs[64];
+	struct coro *c, *next;
+	self = w;
+	if (w->cpu >= 0)
+		affinity_pin_self(w->cpu);
+	for (;;)
+	{
+		pthread_mutex_lock(&w->inbox_mutex);
+		c = w->inbox;
+		w->inbox = 0;
+		pthread_mutex_unlock(&w->inbox_mutex);
+		for (; c; c = next)
+		{
+			next = c->next;
+			getcontext(&c->ctx);
+			c->ctx.uc_stack.ss_sp = c->stack + pagesize;
+			c->ctx.uc_stack.ss_size = stacksize;
+			c->ctx.uc_link = &w->sched;
+			makecontext(&c->ctx, trampoline, 0);
+			enqueue(w, c);
+		}
+		while ((c = w->runq))
+		{
+			if (!(w->runq = c->next))
+				w->runq_tail = 0;
+			c->queued = 0;
+			w->current = c;
+			swapcontext(&w->sched, &c->ctx);
+			w->current = 0;
+			if (c->done)
+			{
+				stack_put(w, c->stack);
+				free(c);
+			}
+		}
+		int timeout = -1;
+		if (w->heapcount)
+		{
+			long long d = w->heap[0]->deadline - now_ms();
+			timeout = d < 0 ? 0 : d > INT_MAX ? INT_MAX : d;
+		}
+		int i, n = epoll_wait(w->epfd, evs, sizeof evs / sizeof evs[0], timeout);
+		for (i = 0; i < n; i++)
+		{
+			if ((c = evs[i].data.ptr))
+				enqueue(w, c);
+			else
+			{
+				uint64_t cnt;
+				read(w->evfd, &cnt, sizeof cnt);
+			}
+		}
+		long long now = now_ms();
+		while (w->heapcount && w->heap[0]->deadline <= now)
+		{
+			c = w->heap[0];
+			heap_remove(w, c);
+			c->timedout = 1;
+			enqueue(w, c);
+		}
+	}
+	return 0;
+}
+
+int coro_init(unsigned n, size_t stacksz)
+{
+	unsigned i;
+	pagesize = sysconf(_SC_PAGESIZE);
+	stacksize = (stacksz + pagesize - 1) & ~(pagesize - 1);
+	if (!n || !(workers = calloc(n, sizeof *workers)))
+		return -1;
+	for (i = 0; i < n; i++)
+	{
+		struct worker *w = &workers[i];
+		struct epoll_event ev = {.events = EPOLLIN, .data.ptr = 0};
+		pthread_mutex_init(&w->inbox_mutex, 0);
+		pthread_mutex_init(&w->stack_mutex, 0);
+		w->cpu = affinity_enabled() ? affinity_cpu(i) : -1;
+		if ((w->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+			return -1;
+		if ((w->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+			return -1;
+		if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->evfd, &ev) == -1)
+			return -1;
+		if (pthread_create(&w->pt, 0, worker_main, w) != 0)
+			return -1;
+	}
+	nworkers = n;
+	return 0;
+}
+
+static struct worker *worker_for(int cpu)
+{
+	unsigned i;
+	if (cpu >= 0)
+		for (i = 0; i < nworkers; i++)
+			if (workers[i].cpu == cpu)
+				return &workers[i];
+	return &workers[spawn_rr++ % nworkers];
+}
+
+int coro_spawn_on(int cpu, void *(*fn)(void *), void *arg)
+{
+	struct worker *w = worker_for(cpu);
+	struct coro *c = calloc(1, sizeof *c);
+	if (!c)
+		return -1;
+	if (!(c->stack = stack_get(w)))
+	{
+		free(c);
+		return -1;
+	}
+	c->fn = fn;
+	c->arg = arg;
+	c->heapidx = NO_HEAP;
+	pthread_mutex_lock(&w->inbox_mutex);
+	int wake = !w->inbox;
+	c->next = w->inbox;
+	w->inbox = c;
+	pthread_mutex_unlock(&w->inbox_mutex);
+	/* a non-empty inbox means the worker was woken already and didn't
+	   pick it up yet, so a burst of accepts costs one wakeup per worker. */
+	uint64_t one = 1;
+	if (wake)
+		write(w->evfd, &one, sizeof one);
+	return 0;
+}
+
+int coro_spawn(void *(*fn)(void *), void *arg)
+{
+	return coro_spawn_on(-1, fn, arg);
+}
+
+int coro_self(void)
+{
+	return self && self->current;
+}
+
+int coro_worker(void)
+{
+	return self ? (int)(self - workers) : -1;
+}
+
+static void unwatch(struct worker *w, struct pollfd *fds, nfds_t nfds)
+{
+	nfds_t i;
+	for (i = 0; i < nfds; i++)
+		if (fds[i].fd >= 0)
+			epoll_ctl(w->epfd, EPOLL_CTL_DEL, fds[i].fd, 0);
+}
+
+int coro_poll(struct pollfd *fds, nfds_t nfds, int timeout_ms)
+{
+	struct worker *w = self;
+	if (!w || !w->current)
+		return poll(fds, nfds, timeout_ms);
+	struct coro *c = w->current;
+	long long deadline = timeout_ms > 0 ? now_ms() + timeout_ms : 0;
+	for (;;)
+	{
+		int r = poll(fds, nfds, 0);
+		if (r != 0 || timeout_ms == 0)
+			return r;
+		if (deadline && deadline <= now_ms())
+			return 0;
+		nfds_t i;
+		for (i = 0; i < nfds; i++)
+		{
+			/* the POLL* bits are identical to their EPOLL* counterparts on linux */
+			struct epoll_event ev = {.events = fds[i].events, .data.ptr = c};
+			if (fds[i].fd < 0 || !epoll_ctl(w->epfd, EPOLL_CTL_ADD, fds[i].fd, &ev))
+				continue;
+			/* not pollable through epoll, fall back to blocking the worker */
+			unwatch(w, fds, i);
+			return poll(fds, nfds, timeout_ms);
+		}
+		c->timedout = 0;
+		c->deadline = deadline;
+		if (deadline && heap_push(w, c))
+		{
+			unwatch(w, fds, nfds);
+			errno = ENOMEM;
+			return -1;
+		}
+		swapcontext(&c->ctx, &w->sched);
+		unwatch(w, fds, nfds);
+		if (c->heapidx != NO_HEAP)
+			heap_remove(w, c);
+		if (c->timedout)
+			return poll(fds, nfds, 0);
+	}
+}
+
+#else
+
+int coro_init(unsigned n, size_t stacksz)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int coro_spawn_on(int cpu, void *(*fn)(void *), void *arg)
+{
+	return -1;
+}
+
+int coro_spawn(void *(*fn)(void *), void *arg)
+{
+	return -1;
+}
+
+int coro_self(void)
+{
+	return 0;
+}
+
+int coro_worker(void)
+{
+	return -1;
+}
+
+int coro_poll(struct pollfd *fds, nfds_t nfds, int timeout_ms)
+{
+	return poll(fds, nfds, timeout_ms);
+}
+
+#endif
+
+ssize_t coro_read(int fd, void *buf, size_t n)
+{
+	for (;;)
+	{
+		ssize_t r = read(fd, buf, n);
+		if (r >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+			return r;
+		struct pollfd p = {.fd = fd, .events = POLLIN};
+		if (coro_poll(&p, 1, -1) == -1)
+			return -1;
+	}
+}
+
+ssize_t coro_write(int fd, const void *buf, size_t n)
+{
+	for (;;)
+	{
+		ssize_t r = write(fd, buf, n);
+		/* EINPROGRESS: the first write on a deferred fast open connect
+		   without cookie, which is sent as plain SYN. */
+		if (r >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINPROGRESS))
+			return r;
+		struct pollfd p = {.fd = fd, .events = POLLOUT};
+		if (coro_poll(&p, 1, -1) == -1)
+			return -1;
+	}
+}
+
+int coro_connect(int fd, const struct sockaddr *addr, socklen_t len, int timeout_ms)
+{
+	if (!coro_self())
+		return connect(fd, addr, len);
+	int fl = fcntl(fd, F_GETFL);
+	if (!(fl & O_NONBLOCK))
+		fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+	if (connect(fd, addr, len) == 0)
+		return 0;
+	if (errno != EINPROGRESS)
+		return -1;
+	struct pollfd p = {.fd = fd, .events = POLLOUT};
+	int r = coro_poll(&p, 1, timeout_ms);
+	if (r <= 0)
+	{
+		if (r == 0)
+			errno = ETIMEDOUT;
+		return -1;
+	}
+	int err;
+	socklen_t errlen = sizeof err;
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1)
+		return -1;
+	if (err)
+	{
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
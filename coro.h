@@ -0,0 +1,42 @@
+#ifndef CORO_H
+#define CORO_H
+
+#include <stddef.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+//RcB: DEP "coro.c"
+
+/* stackful coroutines multiplexed on a small pool of worker threads.
+   a coroutine keeps the sequential style of a session thread: whenever
+   a call would block with EAGAIN, it parks itself in its worker's epoll
+   set and the worker runs another coroutine.
+
+   the coro_* i/o helpers below may be called from anywhere: outside of
+   a coroutine they wait for a non-blocking fd in a plain poll(). */
+
+#ifndef CONFIG_CORO
+#define CONFIG_CORO 1
+#endif
+
+/* start nworkers scheduler threads, every coroutine gets a stack of
+   stacksz bytes plus one guard page. with cpus configured in affinity.h,
+   worker i is pinned to the i-th cpu. returns 0 on success. */
+int coro_init(unsigned nworkers, size_t stacksz);
+/* run fn(arg) in a new coroutine. returns 0 on success, -1 on OOM. */
+int coro_spawn(void *(*fn)(void *), void *arg);
+/* same, but on the worker pinned to cpu if there is one */
+int coro_spawn_on(int cpu, void *(*fn)(void *), void *arg);
+/* nonzero if the caller is running inside a coroutine */
+int coro_self(void);
+/* index of the worker the caller runs on, -1 outside of the workers */
+int coro_worker(void);
+
+int coro_poll(struct pollfd *fds, nfds_t nfds, int timeout_ms);
+ssize_t coro_read(int fd, void *buf, size_t n);
+ssize_t coro_write(int fd, const void *buf, size_t n);
+/* connect with a timeout, returns 0 or -1 with errno set. */
+int coro_connect(int fd, const struct sockaddr *addr, socklen_t len, int timeout_ms);
+
+#endif
@@ -0,0 +1,603 @@
+#define _GNU_SOURCE
+#include "ec.h"
+#include "inspect.h"
+
+#if CONFIG_STRATUM
+#include "sha256.h"
+#include <stdint.h>
+#include <string.h>
+
+/* field elements and scalars are little endian limbs, field elements are
+   kept below p after every operation */
+typedef uint32_t fe[8];
+
+struct point
+{
+	/* jacobian, x = X / Z^2 and y = Y / Z^3 */
+	fe x, y, z;
+	uint32_t inf;
+};
+
+static const fe P = {0xfffffc2f, 0xfffffffe, 0xffffffff, 0xffffffff,
+					 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff};
+static const uint32_t N[8] = {0xd0364141, 0xbfd25e8c, 0xaf48a03b, 0xbaaedce6,
+							  0xfffffffe, 0xffffffff, 0xffffffff, 0xffffffff};
+/* the exponents of inversion, p - 2, and of square roots, (p + 1) / 4 */
+static const uint32_t P_INV[8] = {0xfffffc2d, 0xfffffffe, 0xffffffff, 0xffffffff,
+								  0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff};
+static const uint32_t P_SQRT[8] = {0xbfffff0c, 0xffffffff, 0xffffffff, 0xffffffff,
+								   0xffffffff, 0xffffffff, 0xffffffff, 0x3fffffff};
+/* sqrt(-3), the root (p + 1) / 4 gives like in the BIP 324 reference */
+static const fe C = {0x1cd5f852, 0x7d8d27ae, 0xda14ecd4, 0xc61f6d15,
+					 0xa797962c, 0x233770c2, 0x3507f1df, 0x0a2d2ba9};
+static const fe ZERO = {0}, ONE = {1}, SEVEN = {7};
+static const struct point G = {
+	{0x16f81798, 0x59f2815b, 0x2dce28d9, 0x029bfcdb, 0xce870b07, 0x55a06295, 0xf9dcbbac, 0x79be667e},
+	{0xfb10d4b8, 0x9c47d08f, 0xa6855419, 0xfd17b448, 0x0e1108a8, 0x5da4fbfc, 0x26a3c465, 0x483ada77},
+	{1},
+	0,
+};
+
+static void load(uint32_t r[8], const unsigned char *b)
+{
+	int i;
+	for (i = 0; i < 8; i++)
+		r[i] = (uint32_t)b[28 - 4 * i] << 24 | (uint32_t)b[29 - 4 * i] << 16 |
+			   (uint32_t)b[30 - 4 * i] << 8 | b[31 - 4 * i];
+}
+
+static void store(unsigned char *b, const uint32_t a[8])
+{
+	int i;
+	for (i = 0; i < 8; i++)
+	{
+		b[28 - 4 * i] = a[i] >> 24;
+		b[29 - 4 * i] = a[i] >> 16;
+		b[30 - 4 * i] = a[i] >> 8;
+		b[31 - 4 * i] = a[i];
+	}
+}
+
+static int lt(const uint32_t a[8], const uint32_t b[8])
+{
+	int i;
+	for (i = 7; i >= 0; i--)
+		if (a[i] != b[i])
+			return a[i] < b[i];
+	return 0;
+}
+
+/* r = a - b, returns the borrow */
+static uint32_t sub(uint32_t r[8], const uint32_t a[8], const uint32_t b[8])
+{
+	uint64_t t;
+	uint32_t borrow = 0;
+	int i;
+	for (i = 0; i < 8; i++)
+	{
+		t = (uint64_t)a[i] - b[i] - borrow;
+		r[i] = t;
+		borrow = t >> 63;
+	}
+	return borrow;
+}
+
+static int fe_is_zero(const fe a)
+{
+	uint32_t v = 0;
+	int i;
+	for (i = 0; i < 8; i++)
+		v |= a[i];
+	return !v;
+}
+
+static int fe_eq(const fe a, const fe b)
+{
+	return !memcmp(a, b, sizeof(fe));
+}
+
+/* r + top * 2^256, where 2^256 is 0x1000003d1 mod p */
+static void fe_fold(fe r, uint64_t top)
+{
+	uint64_t c;
+	int i;
+	while (top)
+	{
+		c = (uint64_t)r[0] + top * 0x3d1;
+		r[0] = c;
+		c = (c >> 32) + r[1] + top;
+		r[1] = c;
+		c >>= 32;
+		for (i = 2; i < 8; i++)
+		{
+			c += r[i];
+			r[i] = c;
+			c >>= 32;
+		}
+		top = c;
+	}
+	if (!lt(r, P))
+		sub(r, r, P);
+}
+
+static void fe_add(fe r, const fe a, const fe b)
+{
+	uint64_t c = 0;
+	int i;
+	for (i = 0; i < 8; i++)
+	{
+		c += (uint64_t)a[i] + b[i];
+		r[i] = c;
+		c >>= 32;
+	}
+	fe_fold(r, c);
+}
+
+static void fe_sub(fe r, const fe a, const fe b)
+{
+	uint64_t c = 0;
+	int i;
+	/* on a borrow r is a - b + 2^256, adding p wraps it to a - b + p */
+	if (sub(r, a, b))
+		for (i = 0; i < 8; i++)
+		{
+			c += (uint64_t)r[i] + P[i];
+			r[i] = c;
+			c >>= 32;
+		}
+}
+
+static void fe_neg(fe r, const fe a)
+{
+	fe_sub(r, ZERO, a);
+}
+
+static void fe_mul(fe r, const fe a, const fe b)
+{
+	uint32_t t[16] = {0};
+	uint64_t c;
+	int i, j;
+	for (i = 0; i < 8; i++)
+	{
+		c = 0;
+		for (j = 0; j < 8; j++)
+		{
+			c += (uint64_t)a[i] * b[j] + t[i + j];
+			t[i + j] = c;
+			c >>= 32;
+		}
+		t[i + 8] = c;
+	}
+	/* the high half times 0x1000003d1 goes onto the low half */
+	c = 0;
+	for (i = 0; i < 8; i++)
+	{
+		c += (uint64_t)t[i] + (uint64_t)t[8 + i] * 0x3d1 + (i ? t[7 + i] : 0);
+		r[i] = c;
+		c >>= 32;
+	}
+	fe_fold(r, c + t[15]);
+}
+
+static void fe_sqr(fe r, const fe a)
+{
+	fe_mul(r, a, a);
+}
+
+static void fe_pow(fe r, const fe a, const uint32_t e[8])
+{
+	fe x, acc;
+	int i;
+	memcpy(x, a, sizeof x);
+	memcpy(acc, ONE, sizeof acc);
+	for (i = 255; i >= 0; i--)
+	{
+		fe_sqr(acc, acc);
+		if (e[i / 32] >> (i % 32) & 1)
+			fe_mul(acc, acc, x);
+	}
+	memcpy(r, acc, sizeof acc);
+}
+
+static void fe_inv(fe r, const fe a)
+{
+	fe_pow(r, a, P_INV);
+}
+
+/* -1 if a is not a square */
+static int fe_sqrt(fe r, const fe a)
+{
+	fe t;
+	fe_pow(r, a, P_SQRT);
+	fe_sqr(t, r);
+	return fe_eq(t, a) ? 0 : -1;
+}
+
+static void fe_half(fe r, const fe a)
+{
+	uint32_t t[8], odd = -(a[0] & 1);
+	uint64_t c = 0;
+	int i;
+	for (i = 0; i < 8; i++)
+	{
+		c += (uint64_t)a[i] + (P[i] & odd);
+		t[i] = c;
+		c >>= 32;
+	}
+	for (i = 0; i < 7; i++)
+		r[i] = t[i] >> 1 | t[i + 1] << 31;
+	r[7] = t[7] >> 1 | (uint32_t)c << 31;
+}
+
+/* big endian bytes reduced mod p, -1 if they were not below p */
+static int fe_load(fe r, const unsigned char b[32])
+{
+	load(r, b);
+	if (lt(r, P))
+		return 0;
+	sub(r, r, P);
+	return -1;
+}
+
+/* x^3 + 7 */
+static void curve(fe r, const fe x)
+{
+	fe_sqr(r, x);
+	fe_mul(r, r, x);
+	fe_add(r, r, SEVEN);
+}
+
+static int valid_x(const fe x)
+{
+	fe g, y;
+	curve(g, x);
+	return !fe_sqrt(y, g);
+}
+
+static void pt_double(struct point *r, const struct point *a)
+{
+	fe A, B, C8, D, E, F, t;
+	if (a->inf || fe_is_zero(a->y))
+	{
+		r->inf = 1;
+		return;
+	}
+	fe_sqr(A, a->x);
+	fe_sqr(B, a->y);
+	fe_sqr(C8, B);
+	fe_add(t, a->x, B);
+	fe_sqr(t, t);
+	fe_sub(t, t, A);
+	fe_sub(t, t, C8);
+	fe_add(D, t, t);
+	fe_add(E, A, A);
+	fe_add(E, E, A);
+	fe_sqr(F, E);
+	fe_mul(r->z, a->y, a->z);
+	fe_add(r->z, r->z, r->z);
+	fe_sub(r->x, F, D);
+	fe_sub(r->x, r->x, D);
+	fe_sub(t, D, r->x);
+	fe_mul(t, E, t);
+	fe_add(C8, C8, C8);
+	fe_add(C8, C8, C8);
+	fe_add(C8, C8, C8);
+	fe_sub(r->y, t, C8);
+	r->inf = 0;
+}
+
+static void pt_add(struct point *r, const struct point *a, const struct point *b)
+{
+	fe z1z1, z2z2, u1, u2, s1, s2, h, rr, h2, h3, u1h2, t;
+	if (a->inf || b->inf)
+	{
+		*r = a->inf ? *b : *a;
+		return;
+	}
+	fe_sqr(z1z1, a->z);
+	fe_sqr(z2z2, b->z);
+	fe_mul(u1, a->x, z2z2);
+	fe_mul(u2, b->x, z1z1);
+	fe_mul(s1, a->y, b->z);
+	fe_mul(s1, s1, z2z2);
+	fe_mul(s2, b->y, a->z);
+	fe_mul(s2, s2, z1z1);
+	fe_sub(h, u2, u1);
+	fe_sub(rr, s2, s1);
+	if (fe_is_zero(h))
+	{
+		if (fe_is_zero(rr))
+			pt_double(r, a);
+		else
+			r->inf = 1;
+		return;
+	}
+	fe_sqr(h2, h);
+	fe_mul(h3, h, h2);
+	fe_mul(u1h2, u1, h2);
+	fe_mul(t, a->z, b->z);
+	fe_mul(r->z, t, h);
+	fe_sqr(r->x, rr);
+	fe_sub(r->x, r->x, h3);
+	fe_sub(r->x, r->x, u1h2);
+	fe_sub(r->x, r->x, u1h2);
+	fe_sub(t, u1h2, r->x);
+	fe_mul(t, rr, t);
+	fe_mul(s1, s1, h3);
+	fe_sub(r->y, t, s1);
+	r->inf = 0;
+}
+
+/* r = bit ? a : r, without a branch on bit */
+static void pt_select(struct point *r, const struct point *a, uint32_t bit)
+{
+	uint32_t mask = -bit;
+	int i;
+	for (i = 0; i < 8; i++)
+	{
+		r->x[i] ^= (r->x[i] ^ a->x[i]) & mask;
+		r->y[i] ^= (r->y[i] ^ a->y[i]) & mask;
+		r->z[i] ^= (r->z[i] ^ a->z[i]) & mask;
+	}
+	r->inf ^= (r->inf ^ a->inf) & mask;
+}
+
+/* double and always add */
+static void pt_mul(struct point *r, const struct point *p, const uint32_t k[8])
+{
+	struct point acc = {.inf = 1}, sum;
+	int i;
+	for (i = 255; i >= 0; i--)
+	{
+		pt_double(&acc, &acc);
+		pt_add(&sum, &acc, p);
+		pt_select(&acc, &sum, k[i / 32] >> (i % 32) & 1);
+	}
+	*r = acc;
+}
+
+static void pt_affine(fe x, fe y, const struct point *p)
+{
+	fe zi, t;
+	fe_inv(zi, p->z);
+	fe_sqr(t, zi);
+	fe_mul(x, p->x, t);
+	if (y)
+	{
+		fe_mul(t, t, zi);
+		fe_mul(y, p->y, t);
+	}
+}
+
+/* the point with x and an even y */
+static int lift_x(struct point *r, const fe x)
+{
+	fe g;
+	curve(g, x);
+	if (fe_sqrt(r->y, g))
+		return -1;
+	if (r->y[0] & 1)
+		fe_neg(r->y, r->y);
+	memcpy(r->x, x, sizeof r->x);
+	memcpy(r->z, ONE, sizeof r->z);
+	r->inf = 0;
+	return 0;
+}
+
+static int scalar_load(uint32_t k[8], const unsigned char b[32])
+{
+	load(k, b);
+	return lt(k, N) && !fe_is_zero(k) ? 0 : -1;
+}
+
+int ec_seckey_check(const unsigned char key[32])
+{
+	uint32_t k[8];
+	return scalar_load(k, key);
+}
+
+static void tagged_hash(unsigned char out[32], const char *tag, const void *data, size_t len)
+{
+	unsigned char buf[64 + 160];
+	sha256(tag, strlen(tag), buf);
+	memcpy(buf + 32, buf, 32);
+	memcpy(buf + 64, data, len);
+	sha256(buf, 64 + len, out);
+}
+
+/* XSwiftEC of BIP 324: the x of the first of three candidates on the curve */
+static void xswiftec(fe x, const fe u0, const fe t0)
+{
+	fe u, t, g, t2, X, Y, q, c[3];
+	int i;
+	memcpy(u, fe_is_zero(u0) ? ONE : u0, sizeof u);
+	memcpy(t, fe_is_zero(t0) ? ONE : t0, sizeof t);
+	curve(g, u);
+	fe_sqr(t2, t);
+	fe_add(X, g, t2);
+	if (fe_is_zero(X))
+	{
+		fe_add(t, t, t);
+		fe_sqr(t2, t);
+	}
+	/* X = (u^3 + 7 - t^2) / 2t, Y = (X + t) / (sqrt(-3) u) */
+	fe_sub(X, g, t2);
+	fe_add(q, t, t);
+	fe_inv(q, q);
+	fe_mul(X, X, q);
+	fe_mul(q, C, u);
+	fe_inv(q, q);
+	fe_add(Y, X, t);
+	fe_mul(Y, Y, q);
+	/* u + 4Y^2, (-X/Y - u) / 2, (X/Y - u) / 2 */
+	fe_sqr(c[0], Y);
+	fe_add(c[0], c[0], c[0]);
+	fe_add(c[0], c[0], c[0]);
+	fe_add(c[0], c[0], u);
+	fe_inv(q, Y);
+	fe_mul(q, X, q);
+	fe_neg(c[1], q);
+	fe_sub(c[1], c[1], u);
+	fe_half(c[1], c[1]);
+	fe_sub(c[2], q, u);
+	fe_half(c[2], c[2]);
+	for (i = 0; i < 2 && !valid_x(c[i]); i++)
+		;
+	memcpy(x, c[i], sizeof(fe));
+}
+
+/* a t with xswiftec(u, t) = x. case bit 1 picks the first candidate or
+   one of the other two, bits 0 and 2 pick among the solutions. */
+static int xswiftec_inv(fe t, const fe x, const fe u, unsigned c)
+{
+	fe g, cu, q, d, y, r, check;
+	if (fe_is_zero(u))
+		return -1;
+	curve(g, u);
+	fe_mul(cu, C, u);
+	if (!(c & 2))
+	{
+		/* x as (X/Y - u) / 2 or (-X/Y - u) / 2, the other of the two is
+		   -x - u. with that off the curve the first candidate is as well.
+		   X/Y = q needs t^2 = g (cu - q) / (cu + q). */
+		fe_add(q, x, u);
+		fe_neg(q, q);
+		if (valid_x(q))
+			return -1;
+		fe_add(q, x, x);
+		fe_add(q, q, u);
+		if (c & 1)
+			fe_neg(q, q);
+		fe_add(d, cu, q);
+		if (fe_is_zero(d))
+			return -1;
+		fe_inv(d, d);
+		fe_sub(r, cu, q);
+		fe_mul(r, r, g);
+		fe_mul(r, r, d);
+		if (fe_sqrt(t, r))
+			return -1;
+		if (c & 4)
+			fe_neg(t, t);
+	}
+	else
+	{
+		/* x as u + 4Y^2: Y = sqrt(x - u) / 2 and t solves
+		   t^2 - 2 sqrt(-3) u Y t + g = 0 */
+		fe_sub(y, x, u);
+		if (fe_sqrt(y, y))
+			return -1;
+		fe_half(y, y);
+		if (c & 1)
+			fe_neg(y, y);
+		fe_mul(cu, cu, y);
+		fe_mul(d, u, y);
+		fe_sqr(d, d);
+		fe_add(r, d, d);
+		fe_add(r, r, d);
+		fe_add(r, r, g);
+		fe_neg(r, r);
+		if (fe_sqrt(r, r))
+			return -1;
+		if (c & 4)
+			fe_neg(r, r);
+		fe_add(t, cu, r);
+	}
+	if (fe_is_zero(t))
+		return -1;
+	xswiftec(check, u, t);
+	return fe_eq(check, x) ? 0 : -1;
+}
+
+int ec_ellswift_create(unsigned char out[64], const unsigned char key[32], const unsigned char rnd[32])
+{
+	unsigned char seed[36], h[32];
+	uint32_t k[8], i;
+	struct point p;
+	fe x, u, t;
+	if (scalar_load(k, key))
+		return -1;
+	pt_mul(&p, &G, k);
+	pt_affine(x, 0, &p);
+	memcpy(seed, rnd, 32);
+	for (i = 0;; i++)
+	{
+		seed[32] = i;
+		seed[33] = i >> 8;
+		seed[34] = i >> 16;
+		seed[35] = i >> 24;
+		sha256(seed, sizeof seed, h);
+		fe_load(u, h);
+		sha256(h, 32, h);
+		if (!xswiftec_inv(t, x, u, h[0] & 7))
+			break;
+	}
+	store(out, u);
+	store(out + 32, t);
+	return 0;
+}
+
+void ec_ellswift_decode(unsigned char x[32], const unsigned char in[64])
+{
+	fe u, t, r;
+	fe_load(u, in);
+	fe_load(t, in + 32);
+	xswiftec(r, u, t);
+	store(x, r);
+}
+
+int ec_ellswift_xdh(unsigned char out[32], const unsigned char a[64], const unsigned char b[64],
+					const unsigned char key[32], int initiator)
+{
+	unsigned char buf[160];
+	uint32_t k[8];
+	struct point p;
+	fe x;
+	if (scalar_load(k, key))
+		return -1;
+	ec_ellswift_decode(buf, initiator ? b : a);
+	fe_load(x, buf);
+	/* only x matters, either y does */
+	if (lift_x(&p, x))
+		return -1;
+	pt_mul(&p, &p, k);
+	if (p.inf)
+		return -1;
+	pt_affine(x, 0, &p);
+	memcpy(buf, a, 64);
+	memcpy(buf + 64, b, 64);
+	store(buf + 128, x);
+	tagged_hash(out, "bip324_ellswift_xonly_ecdh", buf, sizeof buf);
+	return 0;
+}
+
+int ec_schnorr_verify(const unsigned char sig[64], const unsigned char msg[32], const unsigned char pub[32])
+{
+	unsigned char buf[96];
+	uint32_t s[8], e[8];
+	struct point pk, sg, ep;
+	fe px, r, rx, ry;
+	if (fe_load(px, pub) || lift_x(&pk, px) || fe_load(r, sig))
+		return -1;
+	load(s, sig + 32);
+	if (!lt(s, N))
+		return -1;
+	memcpy(buf, sig, 32);
+	memcpy(buf + 32, pub, 32);
+	memcpy(buf + 64, msg, 32);
+	tagged_hash(buf, "BIP0340/challenge", buf, sizeof buf);
+	load(e, buf);
+	if (!lt(e, N))
+		sub(e, e, N);
+	/* R = sG - eP = sG + (n - e)P */
+	sub(e, N, e);
+	pt_mul(&sg, &G, s);
+	pt_mul(&ep, &pk, e);
+	pt_add(&sg, &sg, &ep);
+	if (sg.inf)
+		return -1;
+	pt_affine(rx, ry, &sg);
+	return !(ry[0] & 1) && fe_eq(rx, r) ? 0 : -1;
+}
+
+#endif
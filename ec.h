@@ -0,0 +1,29 @@
+#ifndef EC_H
+#define EC_H
+
+//RcB: DEP "ec.c"
+
+/* the secp256k1 arithmetic the noise handshake of stratum v2 needs:
+   public keys in the 64 byte ellswift encoding of BIP 324, the x-only
+   diffie-hellman over them, and BIP 340 signature checks for the pool's
+   certificate. field elements are eight 32 bit limbs so the same code
+   runs on the 32 bit routers. scalar multiplication with a secret key
+   does the same work for every bit; nothing else is constant time, it
+   only ever sees public data. */
+
+/* 0 if key is a valid secret key, 0 < key < n */
+int ec_seckey_check(const unsigned char key[32]);
+/* the ellswift encoding of key * G. rnd seeds the choice among the
+   encodings of the key. returns -1 for an invalid key. */
+int ec_ellswift_create(unsigned char out[64], const unsigned char key[32], const unsigned char rnd[32]);
+/* the x coordinate an ellswift encoding stands for */
+void ec_ellswift_decode(unsigned char x[32], const unsigned char in[64]);
+/* BIP 324 x-only ecdh between the initiator's encoding a and the
+   responder's b, key belongs to a if initiator is set and to b otherwise.
+   out is the tagged hash of a, b and the shared x. */
+int ec_ellswift_xdh(unsigned char out[32], const unsigned char a[64], const unsigned char b[64],
+					const unsigned char key[32], int initiator);
+/* 0 if sig is a valid BIP 340 signature of msg by the x-only key pub */
+int ec_schnorr_verify(const unsigned char sig[64], const unsigned char msg[32], const unsigned char pub[32]);
+
+#endif
@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+# half-close matrix against a running proxy, e.g.
+#   ./microsocks -p 1080 & ./halfclose-test.py 1080 20
+# or with -K to cover the sockmap relay. each round runs both cases through
+# a target of its own on 127.0.0.1:
+#   server-first  the target sends a banner and half-closes, the client
+#                 reads it to the end, then uploads and half-closes
+#   client-first  the client uploads and half-closes, the target echoes
+#                 everything and closes once it has seen the end
+# a case passes if every byte arrives and both ends see EOF. exits nonzero
+# if any round failed.
+import socket, struct, sys, threading, time
+
+BANNER, UPLOAD, ECHO = 50000, 70000, 100000
+
+def socks(proxy, port):
+	s = socket.create_connection(proxy, timeout=10)
+	s.sendall(b'\5\1\0')
+	if s.recv(2) != b'\5\0':
+		raise Exception('method rejected')
+	s.sendall(b'\5\1\0\1' + socket.inet_aton('127.0.0.1') + struct.pack('>H', port))
+	r = s.recv(10)
+	if len(r) < 2 or r[1] != 0:
+		raise Exception('connect failed')
+	return s
+
+def drain(s):
+	n = 0
+	while True:
+		d = s.recv(65536)
+		if not d:
+			return n
+		n += len(d)
+
+def target(handler):
+	ls = socket.socket()
+	ls.bind(('127.0.0.1', 0))
+	ls.listen(64)
+	def run():
+		while True:
+			c, _ = ls.accept()
+			c.settimeout(10)
+			threading.Thread(target=handler, args=(c,), daemon=True).start()
+	threading.Thread(target=run, daemon=True).start()
+	return ls.getsockname()[1]
+
+uploads = []
+
+def banner(c):
+	try:
+		c.sendall(b'B' * BANNER)
+		c.shutdown(socket.SHUT_WR)
+		uploads.append(drain(c))
+	except OSError:
+		uploads.append(-1)
+	c.close()
+
+def echo(c):
+	try:
+		while True:
+			d = c.recv(65536)
+			if not d:
+				break
+			c.sendall(d)
+	except OSError:
+		pass
+	c.close()
+
+def server_first(proxy, port):
+	n = len(uploads)
+	s = socks(proxy, port)
+	down = drain(s)
+	s.sendall(b'U' * UPLOAD)
+	s.shutdown(socket.SHUT_WR)
+	for i in range(200):
+		if len(uploads) > n:
+			break
+		time.sleep(0.05)
+	s.close()
+	up = uploads[n] if len(uploads) > n else None
+	return down == BANNER and up == UPLOAD, 'down %d up %s' % (down, up)
+
+def client_first(proxy, port):
+	s = socks(proxy, port)
+	s.sendall(b'x' * ECHO)
+	s.shutdown(socket.SHUT_WR)
+	got = drain(s)
+	s.close()
+	return got == ECHO, 'echoed %d' % got
+
+def main():
+	if len(sys.argv) < 2:
+		sys.exit('usage: %s [host:]port [rounds]' % sys.argv[0])
+	host, _, port = sys.argv[1].rpartition(':')
+	proxy = (host or '127.0.0.1', int(port))
+	rounds = int(sys.argv[2]) if len(sys.argv) > 2 else 10
+	ports = {server_first: target(banner), client_first: target(echo)}
+	failed = 0
+	for case in (server_first, client_first):
+		ok = 0
+		for i in range(rounds):
+			try:
+				good, what = case(proxy, ports[case])
+			except Exception as e:
+				good, what = False, str(e)
+			ok += good
+			if not good:
+				print('%s round %d: %s' % (case.__name__, i, what))
+		print('%s: %d/%d ok' % (case.__name__.replace('_', '-'), ok, rounds))
+		failed += rounds - ok
+	sys.exit(1 if failed else 0)
+
+main()
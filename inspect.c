@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+#include "inspect.h"
+#include <stdio.h>
+
+#if CONFIG_INSPECT
+#include "mining.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const struct inspector *const inspectors[] = {
+#if CONFIG_STRATUM
+	&stratum_inspector,
+#endif
+};
+
+#define NINSPECTORS (sizeof inspectors / sizeof inspectors[0])
+
+static struct
+{
+	unsigned short port;
+	unsigned char which;
+} ports[INSPECT_PORTS];
+static unsigned nports;
+/* inspectors with ports of their own are not sniffed for */
+static unsigned char bound[NINSPECTORS];
+static unsigned long long sessions[NINSPECTORS], plain;
+
+int inspect_config(const char *arg)
+{
+	const char *colon = strchr(arg, ':'), *p;
+	unsigned i;
+	char *end;
+	for (i = 0; colon && i < NINSPECTORS; i++)
+		if (strlen(inspectors[i]->name) == (size_t)(colon - arg) &&
+			!strncmp(inspectors[i]->name, arg, colon - arg))
+			break;
+	if (!colon || i == NINSPECTORS)
+		return -1;
+	for (p = colon; *p; p = end)
+	{
+		unsigned long port = strtoul(p + 1, &end, 10);
+		if (!port || port > 65535 || (*end && *end != ',') || nports == INSPECT_PORTS)
+			return -1;
+		ports[nports].port = port;
+		ports[nports++].which = i;
+	}
+	bound[i] = 1;
+	return 0;
+}
+
+const struct inspector *inspect_port(unsigned short port)
+{
+	unsigned i;
+	for (i = 0; i < nports; i++)
+		if (ports[i].port == port && inspectors[ports[i].which]->enabled())
+			return inspectors[ports[i].which];
+	return 0;
+}
+
+int inspect_sniffing(void)
+{
+	unsigned i;
+	for (i = 0; i < NINSPECTORS; i++)
+		if (!bound[i] && inspectors[i]->enabled())
+			return 1;
+	return 0;
+}
+
+const struct inspector *inspect_sniff(enum inspect_dir dir, const char *buf, size_t n)
+{
+	unsigned i;
+	for (i = 0; i < NINSPECTORS; i++)
+		if (!bound[i] && inspectors[i]->enabled() && inspectors[i]->sniff(dir, buf, n))
+			return inspectors[i];
+	__atomic_add_fetch(&plain, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+void *inspect_begin(const struct inspector *in)
+{
+	void *state = in->begin();
+	unsigned i;
+	for (i = 0; state && inspectors[i] != in; i++)
+		;
+	if (state)
+		__atomic_add_fetch(&sessions[i], 1, __ATOMIC_RELAXED);
+	return state;
+}
+
+void inspect_dump(int fd)
+{
+	unsigned i;
+	if (!nports && !inspect_sniffing())
+		return;
+	dprintf(fd, "inspect:");
+	for (i = 0; i < NINSPECTORS; i++)
+		if (inspectors[i]->enabled())
+			dprintf(fd, " %s %llu tunnels,", inspectors[i]->name,
+					__atomic_load_n(&sessions[i], __ATOMIC_RELAXED));
+	dprintf(fd, " sniffed plain %llu\n", __atomic_load_n(&plain, __ATOMIC_RELAXED));
+}
+
+#else
+
+int inspect_config(const char *arg)
+{
+	return -1;
+}
+
+const struct inspector *inspect_port(unsigned short port)
+{
+	return 0;
+}
+
+int inspect_sniffing(void)
+{
+	return 0;
+}
+
+const struct inspector *inspect_sniff(enum inspect_dir dir, const char *buf, size_t n)
+{
+	return 0;
+}
+
+void *inspect_begin(const struct inspector *in)
+{
+	return 0;
+}
+
+void inspect_dump(int fd)
+{
+}
+
+#endif
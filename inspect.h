@@ -0,0 +1,69 @@
+#ifndef INSPECT_H
+#define INSPECT_H
+
+#include <stddef.h>
+
+//RcB: DEP "inspect.c"
+
+/* protocol inspectors. the relay loop hands the data of a tunnel to at
+   most one inspector, which watches the messages going either way and
+   may hold back, drop or insert complete messages through its framing
+   hook. a tunnel gets the inspector its destination port is bound to
+   with -I, otherwise the first data of the tunnel is offered to every
+   enabled inspector that isn't bound to ports. tunnels without one are
+   plain and take the fastest relay there is: the kernel sockmap if -K
+   allows, else the user space loop, which then skips every hook.
+   the set of inspectors is fixed at build time, -DCONFIG_STRATUM=0
+   leaves out the stratum one and with it all of the inspection code. */
+
+#ifndef CONFIG_STRATUM
+#define CONFIG_STRATUM 1
+#endif
+
+#define CONFIG_INSPECT (CONFIG_STRATUM)
+
+#define INSPECT_PORTS 16
+
+enum inspect_dir
+{
+	INSPECT_UP = 0,	  /* client -> upstream */
+	INSPECT_DOWN = 1, /* upstream -> client */
+};
+
+struct inspector
+{
+	const char *name;
+	/* nonzero once configured, disabled inspectors are never picked */
+	int (*enabled)(void);
+	/* nonzero if the first data of a tunnel, seen going dir, is ours */
+	int (*sniff)(enum inspect_dir dir, const char *buf, size_t n);
+	/* per tunnel state, 0 if there is no memory for it */
+	void *(*begin)(void);
+	void (*end)(void *state);
+	/* the framing hook, optional. called with data not yet forwarded,
+	   buf[0..len) starting at a message: it may cut messages out and
+	   returns the new length, *tail is set to the bytes at the end that
+	   are an incomplete message and have to wait for the rest. */
+	size_t (*frame)(void *state, enum inspect_dir dir, char *buf, size_t len, size_t *tail);
+	/* the forwarded data, in order */
+	void (*on_client_msg)(void *state, const char *buf, size_t n);
+	void (*on_upstream_msg)(void *state, const char *buf, size_t n);
+	/* copies what the inspector sends to the client itself, between two
+	   messages of the upstream side, to buf. with buf NULL, returns how
+	   many bytes are waiting. optional. */
+	size_t (*reply)(void *state, char *buf, size_t room);
+};
+
+/* "name:port[,port]...", repeatable. returns 0 on success. */
+int inspect_config(const char *arg);
+/* the inspector bound to a destination port, if it is enabled */
+const struct inspector *inspect_port(unsigned short port);
+/* nonzero if tunnels without a bound inspector are to be sniffed */
+int inspect_sniffing(void);
+/* the inspector the first data of a tunnel belongs to, or 0 if it's plain */
+const struct inspector *inspect_sniff(enum inspect_dir dir, const char *buf, size_t n);
+/* in->begin() and the statistics */
+void *inspect_begin(const struct inspector *in);
+void inspect_dump(int fd);
+
+#endif
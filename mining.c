@@ -0,0 +1,1007 @@
+#define _GNU_SOURCE
+#include "mining.h"
+#include <stdio.h>
+
+#if CONFIG_STRATUM
+#include "sha256.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* accepted work per worker in buckets of 10 seconds over 15 minutes */
+#define BUCKET_SECS 10
+#define BUCKETS 90
+#define NAME_MAX_LEN 63
+/* for checking submits: the last jobs, ids of jobs retired by clean_jobs
+   and hashes of recent shares. notify lines are longer than the others. */
+#define CHECK_JOBS 8
+#define CHECK_STALE 16
+#define CHECK_SEEN 64
+#define COINBASE_MAX 1024
+#define BRANCH_MAX 24
+#define EXTRANONCE_MAX 16
+#define NOTIFY_LINE 4096
+#define REPLY_MAX 1024
+/* vardiff looks at the share rate over a minute, or earlier once the
+   miner is four times too fast, and moves by at most 4x per step */
+#define VARDIFF_WINDOW 60
+#define VARDIFF_EARLY 10
+#define VARDIFF_STEP 4
+/* the target of difficulty 1, 0xffff << 208 */
+#define DIFF1_TARGET 0x1.fffep223
+
+struct bucket
+{
+	unsigned long long epoch;
+	unsigned long long work;
+};
+
+struct mining_worker
+{
+	int used;
+	unsigned sessions;
+	unsigned long long accepted, rejected, dropped, diff, vardiff, last_share;
+	struct bucket buckets[BUCKETS];
+	char name[NAME_MAX_LEN + 1];
+};
+
+struct job
+{
+	unsigned char idlen, en1len, nbranch;
+	char id[15];
+	unsigned version, nbits;
+	/* the pool's and the miner's difficulty when the job came */
+	unsigned long long diff, vardiff;
+	size_t c1len, c2len;
+	unsigned char en1[EXTRANONCE_MAX];
+	unsigned char prevhash[32];
+	/* coinbase1 followed by coinbase2 */
+	unsigned char coinbase[COINBASE_MAX];
+	unsigned char branch[BRANCH_MAX][32];
+};
+
+enum verdict
+{
+	SHARE_OK,
+	SHARE_STALE,
+	SHARE_DUPLICATE,
+	SHARE_LOW,
+	SHARE_VERDICTS,
+};
+
+static const struct
+{
+	int code;
+	const char *msg;
+} verdicts[SHARE_VERDICTS] = {
+	[SHARE_STALE] = {21, "Job not found"},
+	[SHARE_DUPLICATE] = {22, "Duplicate share"},
+	[SHARE_LOW] = {23, "Low difficulty share"},
+};
+
+struct mining_check
+{
+	struct job jobs[CHECK_JOBS];
+	unsigned next_job;
+	struct
+	{
+		unsigned char len;
+		char id[15];
+	} stale[CHECK_STALE];
+	unsigned next_stale;
+	unsigned long long seen[CHECK_SEEN];
+	unsigned next_seen;
+	unsigned char en1[EXTRANONCE_MAX];
+	unsigned en1len, en2len;
+	unsigned mask;
+	int have_mask;
+	unsigned char subscribe_idlen;
+	char subscribe_id[15];
+	/* the miner's difficulty set by vardiff, the shares at it since the
+	   window started and whether they could be checked */
+	unsigned long long vardiff;
+	unsigned window_shares;
+	time_t window_start;
+	int verified;
+	/* the current line per direction was longer than MINING_LINE and went out */
+	int passing[2];
+	size_t replylen;
+	char reply[REPLY_MAX];
+	char scratch[MINING_LINE];
+	char line[NOTIFY_LINE];
+};
+
+/* open addressing, entries are never removed. readers only look at
+   entries whose used flag is set, which is published after the name. */
+static struct mining_worker *table;
+static unsigned capacity, max_workers, nworkers;
+static unsigned long long untracked;
+static int validate;
+/* target shares per minute, 0 without vardiff */
+static unsigned vardiff;
+static unsigned long long checked, absorbed, dropped[SHARE_VERDICTS];
+static pthread_mutex_t insert_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int mining_config(const char *arg)
+{
+	unsigned max = strtoul(arg, 0, 10);
+	const char *p;
+	if (!max)
+		return -1;
+	for (p = arg; (p = strchr(p, ',')); )
+	{
+		p++;
+		if (!strncmp(p, "validate", 8) && (!p[8] || p[8] == ','))
+			validate = 1;
+		else if (!strncmp(p, "vardiff=", 8) && (vardiff = strtoul(p + 8, 0, 10)))
+			validate = 1;
+		else
+			return -1;
+	}
+	for (capacity = 16; capacity < 2 * max; capacity *= 2)
+		;
+	max_workers = max;
+	if (validate && sha256_setup())
+		return -1;
+	return (table = calloc(capacity, sizeof *table)) ? 0 : -1;
+}
+
+int mining_enabled(void)
+{
+	return table != 0;
+}
+
+int mining_validating(void)
+{
+	return validate;
+}
+
+static unsigned name_hash(const char *name, size_t len)
+{
+	unsigned h = 2166136261u;
+	while (len--)
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	return h;
+}
+
+static int name_is(const struct mining_worker *w, const char *name, size_t len)
+{
+	return !strncmp(w->name, name, len) && !w->name[len];
+}
+
+static struct mining_worker *worker_get(const char *name, size_t len)
+{
+	unsigned i, n;
+	if (len > NAME_MAX_LEN)
+		len = NAME_MAX_LEN;
+	i = name_hash(name, len);
+	for (n = 0; n < capacity; n++, i++)
+	{
+		struct mining_worker *w = &table[i & (capacity - 1)];
+		if (__atomic_load_n(&w->used, __ATOMIC_ACQUIRE))
+		{
+			if (name_is(w, name, len))
+				return w;
+			continue;
+		}
+		pthread_mutex_lock(&insert_mutex);
+		if (w->used)
+		{
+			/* lost the race for this slot, it may still be ours */
+			pthread_mutex_unlock(&insert_mutex);
+			if (name_is(w, name, len))
+				return w;
+			continue;
+		}
+		if (nworkers == max_workers)
+		{
+			pthread_mutex_unlock(&insert_mutex);
+			break;
+		}
+		memcpy(w->name, name, len);
+		w->name[len] = 0;
+		nworkers++;
+		__atomic_store_n(&w->used, 1, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&insert_mutex);
+		return w;
+	}
+	__atomic_add_fetch(&untracked, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static void add_work(struct mining_worker *w, unsigned long long work, time_t now)
+{
+	unsigned long long epoch = now / BUCKET_SECS, old;
+	struct bucket *b = &w->buckets[epoch % BUCKETS];
+	old = __atomic_load_n(&b->epoch, __ATOMIC_ACQUIRE);
+	/* the first share of a new period recycles the bucket. a share added
+	   concurrently by another session of the worker may get lost. */
+	if (old != epoch && __atomic_compare_exchange_n(&b->epoch, &old, epoch, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+		__atomic_store_n(&b->work, 0, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&b->work, work, __ATOMIC_RELAXED);
+}
+
+/* hashes per second over the last secs seconds */
+static double hashrate(struct mining_worker *w, time_t now, unsigned secs)
+{
+	unsigned long long epoch = now / BUCKET_SECS, work = 0;
+	unsigned i;
+	for (i = 0; i < BUCKETS; i++)
+	{
+		struct bucket *b = &w->buckets[i];
+		if (epoch - __atomic_load_n(&b->epoch, __ATOMIC_ACQUIRE) < secs / BUCKET_SECS)
+			work += __atomic_load_n(&b->work, __ATOMIC_RELAXED);
+	}
+	return work / 1e6 * 4294967296.0 / secs;
+}
+
+/* the value of "key": in a json line, or NULL */
+static const char *value_of(const char *line, const char *key)
+{
+	const char *p = strstr(line, key);
+	if (!p)
+		return 0;
+	for (p += strlen(key); *p == ' ' || *p == '\t'; p++)
+		;
+	if (*p++ != ':')
+		return 0;
+	while (*p == ' ' || *p == '\t')
+		p++;
+	return p;
+}
+
+/* the first element of the params array */
+static const char *first_param(const char *line)
+{
+	const char *p = value_of(line, "\"params\"");
+	if (!p || *p++ != '[')
+		return 0;
+	while (*p == ' ' || *p == '\t')
+		p++;
+	return p;
+}
+
+static size_t string_len(const char *p)
+{
+	const char *end = strchr(p + 1, '"');
+	return end ? (size_t)(end - p - 1) : 0;
+}
+
+static size_t id_of(const char *line, char *id, size_t max)
+{
+	const char *p = value_of(line, "\"id\""), *end;
+	size_t len;
+	if (!p)
+		return 0;
+	if (*p == '"')
+		end = strchr(p + 1, '"') ? strchr(p + 1, '"') + 1 : p;
+	else
+		for (end = p; *end && !strchr(",} \t", *end); end++)
+			;
+	len = end - p;
+	if (!len || len > max || !strncmp(p, "null", len))
+		return 0;
+	memcpy(id, p, len);
+	return len;
+}
+
+/* the element after the one at p in a json array, NULL at its end */
+static const char *next_value(const char *p)
+{
+	int depth = 0, str = 0;
+	for (; *p; p++)
+	{
+		if (str)
+		{
+			if (*p == '\\' && p[1])
+				p++;
+			else if (*p == '"')
+				str = 0;
+		}
+		else if (*p == '"')
+			str = 1;
+		else if (*p == '[' || *p == '{')
+			depth++;
+		else if (*p == ']' || *p == '}')
+		{
+			if (!depth--)
+				return 0;
+		}
+		else if (*p == ',' && !depth)
+		{
+			for (p++; *p == ' ' || *p == '\t'; p++)
+				;
+			return p;
+		}
+	}
+	return 0;
+}
+
+static int hexval(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/* decodes the hex string at p, returns the number of bytes or -1 */
+static int unhex(const char *p, unsigned char *out, size_t max)
+{
+	size_t n = 0;
+	if (!p || *p++ != '"')
+		return -1;
+	for (; *p != '"'; p += 2)
+	{
+		int hi = hexval(p[0]), lo = hi < 0 ? -1 : hexval(p[1]);
+		if (lo < 0 || n == max)
+			return -1;
+		out[n++] = hi << 4 | lo;
+	}
+	return n;
+}
+
+/* a 32 bit field of the header, sent as 8 hex digits */
+static int hex32(const char *p, unsigned *v)
+{
+	unsigned char b[4];
+	if (unhex(p, b, sizeof b) != 4)
+		return -1;
+	*v = (unsigned)b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+	return 0;
+}
+
+static void put32(unsigned char *p, unsigned v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static struct job *job_find(struct mining_check *c, const char *id, size_t len)
+{
+	unsigned i;
+	for (i = 0; i < CHECK_JOBS; i++)
+		if (c->jobs[i].idlen == len && !memcmp(c->jobs[i].id, id, len))
+			return &c->jobs[i];
+	return 0;
+}
+
+static int job_retired(struct mining_check *c, const char *id, size_t len)
+{
+	unsigned i;
+	for (i = 0; i < CHECK_STALE; i++)
+		if (c->stale[i].len == len && !memcmp(c->stale[i].id, id, len))
+			return 1;
+	return 0;
+}
+
+/* params: job id, prevhash, coinbase1, coinbase2, merkle branch, version,
+   nbits, ntime, clean_jobs */
+static void notified(struct mining_session *s, const char *line)
+{
+	struct mining_check *c = s->check;
+	const char *p[9];
+	unsigned char prev[32];
+	struct job *j;
+	size_t len;
+	int i, n;
+	for (p[0] = first_param(line), i = 1; i < 9; i++)
+		if (!p[i - 1] || !(p[i] = next_value(p[i - 1])))
+			return;
+	if (*p[0] != '"' || !(len = string_len(p[0])) || len > sizeof j->id)
+		return;
+	if (!strncmp(p[8], "true", 4))
+	{
+		/* shares for the old jobs are stale from now on */
+		for (i = 0; i < CHECK_JOBS; i++)
+		{
+			if (!c->jobs[i].idlen)
+				continue;
+			unsigned k = c->next_stale++ % CHECK_STALE;
+			memcpy(c->stale[k].id, c->jobs[i].id, c->jobs[i].idlen);
+			c->stale[k].len = c->jobs[i].idlen;
+			c->jobs[i].idlen = 0;
+		}
+		memset(c->seen, 0, sizeof c->seen);
+	}
+	if (!(j = job_find(c, p[0] + 1, len)))
+		j = &c->jobs[c->next_job++ % CHECK_JOBS];
+	j->idlen = 0;
+	if (unhex(p[1], prev, sizeof prev) != 32 || (n = unhex(p[2], j->coinbase, COINBASE_MAX)) < 0)
+		return;
+	j->c1len = n;
+	if ((n = unhex(p[3], j->coinbase + j->c1len, COINBASE_MAX - j->c1len)) < 0)
+		return;
+	j->c2len = n;
+	/* the prevhash comes with the bytes of each 32 bit word swapped */
+	for (i = 0; i < 32; i++)
+		j->prevhash[i] = prev[(i & ~3) + 3 - (i & 3)];
+	const char *b = p[4];
+	if (*b++ != '[')
+		return;
+	while (*b == ' ' || *b == '\t')
+		b++;
+	for (j->nbranch = 0; b && *b != ']'; b = next_value(b))
+		if (j->nbranch == BRANCH_MAX || unhex(b, j->branch[j->nbranch++], 32) != 32)
+			return;
+	if (hex32(p[5], &j->version) || hex32(p[6], &j->nbits))
+		return;
+	memcpy(j->en1, c->en1, c->en1len);
+	j->en1len = c->en1len;
+	j->diff = s->diff;
+	j->vardiff = c->vardiff;
+	memcpy(j->id, p[0] + 1, len);
+	j->idlen = len;
+}
+
+/* the extranonce1 and extranonce2 size, from the subscribe result or
+   mining.set_extranonce */
+static void extranonce(struct mining_check *c, const char *p)
+{
+	int n = unhex(p, c->en1, sizeof c->en1);
+	const char *size = p ? next_value(p) : 0;
+	c->en1len = n > 0 ? n : 0;
+	c->en2len = size && n > 0 ? strtoul(size, 0, 10) : 0;
+}
+
+static void subscribed(struct mining_check *c, const char *result)
+{
+	const char *p;
+	/* [subscriptions, extranonce1, extranonce2 size] */
+	if (*result++ != '[')
+		return;
+	while (*result == ' ' || *result == '\t')
+		result++;
+	if ((p = next_value(result)))
+		extranonce(c, p);
+}
+
+/* the lower of the difficulty when the job came and the current one, the
+   miner may still work at the old one after a change. 0 if unknown. */
+static unsigned long long required(unsigned long long then, unsigned long long now)
+{
+	return then && (!now || then < now) ? then : now;
+}
+
+/* *sdiff is set to the difficulty of a checked share and *pool to what the
+   pool requires for it, in millionths */
+static enum verdict verdict_of(struct mining_session *s, const char *line, double *sdiff,
+							   unsigned long long *pool)
+{
+	struct mining_check *c = s->check;
+	const char *p[6];
+	unsigned char cb[COINBASE_MAX + 2 * EXTRANONCE_MAX], hdr[80], hash[32], en2[EXTRANONCE_MAX];
+	unsigned ntime, nonce, version, rolled, i;
+	unsigned long long key, need;
+	struct job *j;
+	size_t len;
+	int n;
+	/* worker, job id, extranonce2, ntime, nonce, optionally version bits */
+	for (p[0] = first_param(line), i = 1; i < 6; i++)
+		p[i] = p[i - 1] ? next_value(p[i - 1]) : 0;
+	*sdiff = 0;
+	if (!p[4] || *p[1] != '"' || !(len = string_len(p[1])))
+		return SHARE_OK;
+	if (!(j = job_find(c, p[1] + 1, len)))
+		return job_retired(c, p[1] + 1, len) ? SHARE_STALE : SHARE_OK;
+	/* without the extranonces the pool has to judge */
+	n = unhex(p[2], en2, sizeof en2);
+	if (!j->en1len || n <= 0 || (c->en2len && (unsigned)n != c->en2len))
+		return SHARE_OK;
+	if (hex32(p[3], &ntime) || hex32(p[4], &nonce))
+		return SHARE_OK;
+	version = j->version;
+	if (p[5] && *p[5] == '"')
+	{
+		if (!c->have_mask || hex32(p[5], &rolled))
+			return SHARE_OK;
+		version = (version & ~c->mask) | (rolled & c->mask);
+	}
+	memcpy(cb, j->coinbase, j->c1len);
+	len = j->c1len;
+	memcpy(cb + len, j->en1, j->en1len);
+	len += j->en1len;
+	memcpy(cb + len, en2, n);
+	len += n;
+	memcpy(cb + len, j->coinbase + j->c1len, j->c2len);
+	len += j->c2len;
+	put32(hdr, version);
+	memcpy(hdr + 4, j->prevhash, 32);
+	sha256d(cb, len, hdr + 36);
+	sha256d_merkle(hdr + 36, (const unsigned char (*)[32])j->branch, j->nbranch);
+	put32(hdr + 68, ntime);
+	put32(hdr + 72, j->nbits);
+	put32(hdr + 76, nonce);
+	sha256d(hdr, 80, hash);
+	__atomic_add_fetch(&checked, 1, __ATOMIC_RELAXED);
+
+	memcpy(&key, hash, sizeof key);
+	for (i = 0; i < CHECK_SEEN; i++)
+		if (c->seen[i] == key)
+			return SHARE_DUPLICATE;
+	/* the hash is a little endian number, its difficulty is diff1 / hash */
+	double h = 0;
+	for (i = 32; i--;)
+		h = h * 256 + hash[i];
+	*sdiff = h ? DIFF1_TARGET / h * 1e6 : 1e300;
+	*pool = required(j->diff, s->diff);
+	/* the margin keeps rounding on the pool's side */
+	need = vardiff ? required(j->vardiff, c->vardiff) : *pool;
+	if (*sdiff < need * (1 - 1e-6))
+		return SHARE_LOW;
+	c->seen[c->next_seen++ % CHECK_SEEN] = key;
+	return SHARE_OK;
+}
+
+/* queues a line for the miner, returns -1 if there is no room */
+static int reply(struct mining_check *c, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+	va_start(ap, fmt);
+	n = vsnprintf(c->reply + c->replylen, sizeof c->reply - c->replylen, fmt, ap);
+	va_end(ap);
+	if (n < 0 || (size_t)n >= sizeof c->reply - c->replylen)
+		return -1;
+	c->replylen += n;
+	return 0;
+}
+
+/* moves the miner's difficulty towards the target share rate. below the
+   pool's difficulty only once shares were checked, the pool would reject
+   the weaker ones otherwise. */
+static void retarget(struct mining_session *s, time_t now)
+{
+	struct mining_check *c = s->check;
+	double elapsed = now - c->window_start, f;
+	unsigned long long d;
+	if (!vardiff || !c->vardiff || elapsed < VARDIFF_EARLY)
+		return;
+	if (elapsed < VARDIFF_WINDOW && c->window_shares < VARDIFF_STEP * vardiff * elapsed / 60)
+		return;
+	f = c->window_shares * 60 / elapsed / vardiff;
+	c->window_start = now;
+	c->window_shares = 0;
+	/* close enough, don't make the miner switch for nothing */
+	if (f > 0.7 && f < 1.4)
+		return;
+	f = f < 1.0 / VARDIFF_STEP ? 1.0 / VARDIFF_STEP : f > VARDIFF_STEP ? VARDIFF_STEP : f;
+	d = c->vardiff * f;
+	if (!c->verified && d < s->diff)
+		d = s->diff;
+	if (!d || d == c->vardiff || reply(c, "{\"id\":null,\"method\":\"mining.set_difficulty\",\"params\":[%.10g]}\n", d / 1e6))
+		return;
+	c->vardiff = d;
+	if (s->worker)
+		__atomic_store_n(&s->worker->vardiff, d, __ATOMIC_RELAXED);
+}
+
+/* returns 1 if the submit was answered locally and must not go out */
+static int screen_submit(struct mining_session *s, const char *line)
+{
+	struct mining_check *c = s->check;
+	struct mining_worker *w = s->worker;
+	const char *p = first_param(line);
+	unsigned long long pool;
+	double sdiff;
+	enum verdict v = verdict_of(s, line, &sdiff, &pool);
+	char id[sizeof s->pending[0].id];
+	size_t len = id_of(line, id, sizeof id);
+	if (v == SHARE_OK && vardiff)
+	{
+		c->verified = sdiff > 0;
+		c->window_shares++;
+		retarget(s, time(0));
+		/* good enough for the miner's difficulty but not for the pool's:
+		   the miner gets its answer here and the pool never sees it */
+		if (!sdiff || sdiff >= pool * (1 - 1e-6) || !len ||
+			reply(c, "{\"id\":%.*s,\"result\":true,\"error\":null}\n", (int)len, id))
+			return 0;
+		__atomic_add_fetch(&absorbed, 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+	/* no room for the answer, the pool will tell */
+	if (v == SHARE_OK || !len ||
+		reply(c, "{\"id\":%.*s,\"result\":null,\"error\":[%d,\"%s\",null]}\n", (int)len, id,
+			  verdicts[v].code, verdicts[v].msg))
+		return 0;
+	if (p && *p == '"' && string_len(p))
+		w = worker_get(p + 1, string_len(p));
+	if (w)
+		__atomic_add_fetch(&w->dropped, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&dropped[v], 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+/* set by the pool, vardiff leaves the miner at its own difficulty */
+static void pool_difficulty(struct mining_session *s, const char *line)
+{
+	struct mining_check *c = s->check;
+	const char *p = first_param(line);
+	if (!p)
+		return;
+	s->diff = strtod(p, 0) * 1e6 + 0.5;
+	if (s->worker)
+		__atomic_store_n(&s->worker->diff, s->diff, __ATOMIC_RELAXED);
+	if (!vardiff || !c || (c->vardiff && (c->verified || c->vardiff >= s->diff)))
+		return;
+	/* the first one, or unchecked shares would fall short of the pool's */
+	if (!c->vardiff)
+		c->window_start = time(0);
+	c->vardiff = s->diff;
+	if (s->worker)
+		__atomic_store_n(&s->worker->vardiff, s->diff, __ATOMIC_RELAXED);
+}
+
+/* returns 1 if the pool's set_difficulty is replaced by the miner's */
+static int screen_difficulty(struct mining_session *s, const char *line)
+{
+	unsigned long long was = s->check->vardiff;
+	pool_difficulty(s, line);
+	return was && was == s->check->vardiff;
+}
+
+static void submitted(struct mining_session *s, const char *line)
+{
+	const char *p = first_param(line);
+	struct mining_worker *w = s->worker;
+	unsigned slot = s->next_pending++ % MINING_PENDING;
+	/* proxies may submit for several workers over one connection */
+	if (p && *p == '"' && string_len(p))
+		w = worker_get(p + 1, string_len(p));
+	s->pending[slot].idlen = id_of(line, s->pending[slot].id, sizeof s->pending[slot].id);
+	/* the share met the miner's difficulty if that is the higher one */
+	s->pending[slot].diff = s->check && s->check->vardiff > s->diff ? s->check->vardiff : s->diff;
+	s->pending[slot].worker = w;
+}
+
+static void responded(struct mining_session *s, const char *line, const char *result)
+{
+	char id[sizeof s->pending[0].id];
+	size_t len = id_of(line, id, sizeof id);
+	unsigned i;
+	for (i = 0; len && i < MINING_PENDING; i++)
+	{
+		struct mining_worker *w = s->pending[i].worker;
+		if (s->pending[i].idlen != len || memcmp(s->pending[i].id, id, len))
+			continue;
+		s->pending[i].idlen = 0;
+		if (!w)
+			return;
+		if (strncmp(result, "true", 4))
+		{
+			__atomic_add_fetch(&w->rejected, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		time_t now = time(0);
+		__atomic_add_fetch(&w->accepted, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&w->last_share, now, __ATOMIC_RELAXED);
+		add_work(w, s->pending[i].diff, now);
+		return;
+	}
+}
+
+static void handle_line(struct mining_session *s, enum mining_dir dir, const char *line)
+{
+	const char *m = value_of(line, "\"method\""), *p;
+	struct mining_check *c = s->check;
+	if (m && *m == '"')
+	{
+		m++;
+		if (dir == MINING_UP && !strncmp(m, "mining.submit\"", 14))
+			submitted(s, line);
+		else if (c && dir == MINING_DOWN && !strncmp(m, "mining.notify\"", 14))
+		{
+			notified(s, line);
+			/* a new difficulty goes out after the job, which still has the old */
+			retarget(s, time(0));
+		}
+		else if (c && dir == MINING_UP && !strncmp(m, "mining.subscribe\"", 17))
+			c->subscribe_idlen = id_of(line, c->subscribe_id, sizeof c->subscribe_id);
+		else if (c && dir == MINING_DOWN && !strncmp(m, "mining.set_extranonce\"", 22))
+			extranonce(c, first_param(line));
+		else if (c && dir == MINING_DOWN && !strncmp(m, "mining.set_version_mask\"", 24))
+			c->have_mask = !hex32(first_param(line), &c->mask);
+		else if (dir == MINING_DOWN && !strncmp(m, "mining.set_difficulty\"", 22))
+			pool_difficulty(s, line);
+		else if (dir == MINING_UP && !strncmp(m, "mining.authorize\"", 17) && !s->worker)
+		{
+			if (!(p = first_param(line)) || *p != '"' || !string_len(p))
+				return;
+			if ((s->worker = worker_get(p + 1, string_len(p))))
+			{
+				__atomic_add_fetch(&s->worker->sessions, 1, __ATOMIC_RELAXED);
+				if (s->diff)
+					__atomic_store_n(&s->worker->diff, s->diff, __ATOMIC_RELAXED);
+				if (c && c->vardiff)
+					__atomic_store_n(&s->worker->vardiff, c->vardiff, __ATOMIC_RELAXED);
+			}
+		}
+		return;
+	}
+	if (dir != MINING_DOWN || !(p = value_of(line, "\"result\"")))
+		return;
+	if (c)
+	{
+		char id[sizeof c->subscribe_id];
+		const char *mask = value_of(line, "\"version-rolling.mask\"");
+		if (c->subscribe_idlen && id_of(line, id, sizeof id) == c->subscribe_idlen &&
+			!memcmp(id, c->subscribe_id, c->subscribe_idlen))
+			subscribed(c, p);
+		if (mask)
+			c->have_mask = !hex32(mask, &c->mask);
+	}
+	responded(s, line, p);
+}
+
+void mining_begin(struct mining_session *s)
+{
+	unsigned i;
+	s->worker = 0;
+	s->diff = 0;
+	s->next_pending = 0;
+	s->state = 0;
+	for (i = 0; i < MINING_PENDING; i++)
+		s->pending[i].idlen = 0;
+	s->in[0].len = s->in[1].len = 0;
+	s->in[0].skip = s->in[1].skip = 0;
+	/* a failed allocation only means this session isn't checked */
+	s->check = validate ? calloc(1, sizeof *s->check) : 0;
+}
+
+void mining_feed(struct mining_session *s, enum mining_dir dir, const char *buf, size_t n)
+{
+	const char *nl;
+	size_t seg, max = MINING_LINE;
+	char *line = s->in[dir].line;
+	if (dir == MINING_DOWN && s->check)
+	{
+		line = s->check->line;
+		max = sizeof s->check->line;
+	}
+	/* stratum is json, one message per line, and the miner talks first */
+	if (!s->state)
+		s->state = n && buf[0] == '{' && dir == MINING_UP ? 1 : -1;
+	if (s->state < 0)
+		return;
+	while (n)
+	{
+		nl = memchr(buf, '\n', n);
+		seg = nl ? (size_t)(nl - buf) : n;
+		if (s->in[dir].len + seg < max)
+		{
+			memcpy(line + s->in[dir].len, buf, seg);
+			s->in[dir].len += seg;
+		}
+		else
+			s->in[dir].skip = 1;
+		if (!nl)
+			return;
+		if (!s->in[dir].skip)
+		{
+			line[s->in[dir].len] = 0;
+			handle_line(s, dir, line);
+		}
+		s->in[dir].len = 0;
+		s->in[dir].skip = 0;
+		buf = nl + 1;
+		n -= seg + 1;
+	}
+}
+
+void mining_end(struct mining_session *s)
+{
+	if (s->worker)
+		__atomic_sub_fetch(&s->worker->sessions, 1, __ATOMIC_RELAXED);
+	free(s->check);
+}
+
+size_t mining_screen(struct mining_session *s, enum mining_dir dir, char *buf, size_t len, size_t *tail)
+{
+	struct mining_check *c = s->check;
+	/* submits from the miner, with vardiff difficulties from the pool */
+	const char *what = dir == MINING_UP ? "\"mining.submit\"" : "\"mining.set_difficulty\"";
+	size_t at = 0, out = 0, n;
+	const char *nl;
+	*tail = 0;
+	if (!c || s->state < 0 || (dir == MINING_DOWN && !vardiff))
+		return len;
+	if (!s->state && (dir == MINING_DOWN || (len && buf[0] != '{')))
+		return len;
+	while (at < len)
+	{
+		if (!(nl = memchr(buf + at, '\n', len - at)))
+		{
+			n = len - at;
+			/* what we look for fits into a line, longer ones aren't held back */
+			if (!c->passing[dir] && n < MINING_LINE)
+				*tail = n;
+			else
+				c->passing[dir] = 1;
+			memmove(buf + out, buf + at, n);
+			return out + n;
+		}
+		n = nl - (buf + at) + 1;
+		if (!c->passing[dir] && n < MINING_LINE && memmem(buf + at, n, what, strlen(what)))
+		{
+			memcpy(c->scratch, buf + at, n);
+			c->scratch[n] = 0;
+			if (dir == MINING_UP ? screen_submit(s, c->scratch) : screen_difficulty(s, c->scratch))
+			{
+				at += n;
+				continue;
+			}
+		}
+		c->passing[dir] = 0;
+		memmove(buf + out, buf + at, n);
+		out += n;
+		at += n;
+	}
+	return out;
+}
+
+size_t mining_reply(struct mining_session *s, char *buf, size_t room)
+{
+	struct mining_check *c = s->check;
+	size_t n;
+	/* only between two lines of the pool */
+	if (!c || !(n = c->replylen) || s->in[MINING_DOWN].len || s->in[MINING_DOWN].skip)
+		return 0;
+	if (!buf)
+		return n;
+	if (n > room)
+		return 0;
+	memcpy(buf, c->reply, n);
+	c->replylen = 0;
+	return n;
+}
+
+/* stratum is json, one message per line, and the miner talks first,
+   with a mining.subscribe, .configure or .authorize */
+static int stratum_sniff(enum inspect_dir dir, const char *buf, size_t n)
+{
+	return dir == INSPECT_UP && n && buf[0] == '{' && memmem(buf, n, "\"mining.", 8);
+}
+
+static void *stratum_begin(void)
+{
+	struct mining_session *s = malloc(sizeof *s);
+	if (s)
+		mining_begin(s);
+	return s;
+}
+
+static void stratum_end(void *s)
+{
+	mining_end(s);
+	free(s);
+}
+
+static size_t stratum_frame(void *s, enum inspect_dir dir, char *buf, size_t len, size_t *tail)
+{
+	return mining_screen(s, dir == INSPECT_UP ? MINING_UP : MINING_DOWN, buf, len, tail);
+}
+
+static void stratum_client_msg(void *s, const char *buf, size_t n)
+{
+	mining_feed(s, MINING_UP, buf, n);
+}
+
+static void stratum_upstream_msg(void *s, const char *buf, size_t n)
+{
+	mining_feed(s, MINING_DOWN, buf, n);
+}
+
+static size_t stratum_reply(void *s, char *buf, size_t room)
+{
+	return mining_reply(s, buf, room);
+}
+
+const struct inspector stratum_inspector = {
+	.name = "stratum",
+	.enabled = mining_enabled,
+	.sniff = stratum_sniff,
+	.begin = stratum_begin,
+	.end = stratum_end,
+	.frame = stratum_frame,
+	.on_client_msg = stratum_client_msg,
+	.on_upstream_msg = stratum_upstream_msg,
+	.reply = stratum_reply,
+};
+
+static const char *human(char *buf, size_t size, double v)
+{
+	static const char units[] = " kMGTPE";
+	unsigned u = 0;
+	while (v >= 1000 && u < sizeof units - 2)
+	{
+		v /= 1000;
+		u++;
+	}
+	snprintf(buf, size, u ? "%.2f%c" : "%.0f", v, units[u]);
+	return buf;
+}
+
+void mining_dump_workers(int fd)
+{
+	char r1[16], r5[16], r15[16];
+	time_t now = time(0);
+	unsigned i;
+	for (i = 0; table && i < capacity; i++)
+	{
+		struct mining_worker *w = &table[i];
+		if (!__atomic_load_n(&w->used, __ATOMIC_ACQUIRE))
+			continue;
+		unsigned long long last = __atomic_load_n(&w->last_share, __ATOMIC_RELAXED);
+		char vd[32] = "";
+		if (vardiff)
+			snprintf(vd, sizeof vd, " vardiff %g", __atomic_load_n(&w->vardiff, __ATOMIC_RELAXED) / 1e6);
+		dprintf(fd, "worker %s: sessions %u accepted %llu rejected %llu dropped %llu diff %g%s "
+					"hashrate 1m %sH/s 5m %sH/s 15m %sH/s last share %lds ago\n",
+				w->name, __atomic_load_n(&w->sessions, __ATOMIC_RELAXED),
+				__atomic_load_n(&w->accepted, __ATOMIC_RELAXED),
+				__atomic_load_n(&w->rejected, __ATOMIC_RELAXED),
+				__atomic_load_n(&w->dropped, __ATOMIC_RELAXED),
+				__atomic_load_n(&w->diff, __ATOMIC_RELAXED) / 1e6, vd,
+				human(r1, sizeof r1, hashrate(w, now, 60)),
+				human(r5, sizeof r5, hashrate(w, now, 300)),
+				human(r15, sizeof r15, hashrate(w, now, 900)),
+				last ? (long)(now - last) : -1L);
+	}
+}
+
+void mining_dump(int fd)
+{
+	unsigned long long accepted = 0, rejected = 0;
+	unsigned i, n = 0, sessions = 0;
+	double rate = 0;
+	char r5[16];
+	time_t now = time(0);
+	if (!table)
+		return;
+	for (i = 0; i < capacity; i++)
+	{
+		struct mining_worker *w = &table[i];
+		if (!__atomic_load_n(&w->used, __ATOMIC_ACQUIRE))
+			continue;
+		n++;
+		sessions += __atomic_load_n(&w->sessions, __ATOMIC_RELAXED);
+		accepted += __atomic_load_n(&w->accepted, __ATOMIC_RELAXED);
+		rejected += __atomic_load_n(&w->rejected, __ATOMIC_RELAXED);
+		rate += hashrate(w, now, 300);
+	}
+	dprintf(fd, "mining: %u workers (%llu untracked) %u sessions, shares accepted %llu rejected %llu, "
+				"hashrate 5m %sH/s\n",
+			n, __atomic_load_n(&untracked, __ATOMIC_RELAXED), sessions, accepted, rejected,
+			human(r5, sizeof r5, rate));
+	if (validate)
+		dprintf(fd, "mining: %llu shares checked (%s), dropped %llu stale %llu duplicate %llu low difficulty\n",
+				__atomic_load_n(&checked, __ATOMIC_RELAXED), sha256_impl(),
+				__atomic_load_n(&dropped[SHARE_STALE], __ATOMIC_RELAXED),
+				__atomic_load_n(&dropped[SHARE_DUPLICATE], __ATOMIC_RELAXED),
+				__atomic_load_n(&dropped[SHARE_LOW], __ATOMIC_RELAXED));
+	if (vardiff)
+		dprintf(fd, "mining: vardiff %u shares/min, %llu shares below the pool's difficulty answered locally\n",
+				vardiff, __atomic_load_n(&absorbed, __ATOMIC_RELAXED));
+}
+
+#else
+
+int mining_config(const char *arg)
+{
+	return -1;
+}
+
+void mining_dump_workers(int fd)
+{
+}
+
+void mining_dump(int fd)
+{
+}
+
+#endif
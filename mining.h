@@ -0,0 +1,92 @@
+#ifndef MINING_H
+#define MINING_H
+
+#include "inspect.h"
+#include <stddef.h>
+
+//RcB: DEP "mining.c"
+
+/* per worker statistics of the stratum sessions we relay. the relay loop
+   feeds every chunk to the session's line parser, which picks up the
+   worker name from mining.authorize, the difficulty from
+   mining.set_difficulty and the pool's verdict on every mining.submit.
+   the hashrate is estimated from the difficulty of accepted shares:
+   a share of difficulty d takes d * 2^32 hashes on average.
+   all state lives in the session or in the preallocated worker table,
+   and updates are atomic, so the relay path neither allocates nor locks.
+   optionally the submits are checked before they reach the pool: the
+   header is rebuilt from the job's mining.notify, the extranonces and the
+   submitted fields, and shares for retired jobs, repeated shares and
+   shares below the difficulty are answered by the proxy instead. shares
+   it cannot check (unknown job, missing extranonce or version mask) go
+   through unchanged.
+   vardiff gives each miner its own difficulty for a target share rate:
+   the pool's mining.set_difficulty is replaced by the miner's, and shares
+   that meet the miner's difficulty but not the pool's are accepted by the
+   proxy without going upstream.
+   the relay loop drives all of this as the "stratum" inspector, builds
+   with -DCONFIG_STRATUM=0 leave it out. */
+
+#define MINING_LINE 512
+#define MINING_PENDING 16
+
+enum mining_dir
+{
+	MINING_UP = 0,	 /* miner -> pool */
+	MINING_DOWN = 1, /* pool -> miner */
+};
+
+struct mining_worker;
+struct mining_check;
+
+struct mining_session
+{
+	struct mining_worker *worker;
+	/* 0 until the first data, 1 for stratum, -1 for anything else */
+	int state;
+	/* difficulty in millionths */
+	unsigned long long diff;
+	/* submits waiting for the pool's response */
+	struct
+	{
+		struct mining_worker *worker;
+		unsigned long long diff;
+		unsigned char idlen;
+		char id[15];
+	} pending[MINING_PENDING];
+	unsigned next_pending;
+	/* incomplete line per direction, longer lines are skipped */
+	struct
+	{
+		size_t len;
+		int skip;
+		char line[MINING_LINE];
+	} in[2];
+	/* jobs and verdicts, allocated by mining_begin() when validating */
+	struct mining_check *check;
+};
+
+/* "maxworkers[,validate][,vardiff=shares per minute]", vardiff implies
+   validate. returns 0 on success. */
+int mining_config(const char *arg);
+int mining_enabled(void);
+int mining_validating(void);
+void mining_begin(struct mining_session *s);
+void mining_feed(struct mining_session *s, enum mining_dir dir, const char *buf, size_t n);
+void mining_end(struct mining_session *s);
+/* screens data not yet forwarded, buf[0..len) starting at a line: submits
+   to drop and, with vardiff, the pool's difficulties are cut out, the rest
+   moves up. returns the new length, *tail is set to the bytes at its end
+   that belong to an incomplete line and have to wait for the rest of it. */
+size_t mining_screen(struct mining_session *s, enum mining_dir dir, char *buf, size_t len, size_t *tail);
+/* copies the answers to dropped submits and the miner's difficulties to
+   buf, if the pool's data ended at a line break. with buf NULL, returns
+   how many bytes are waiting. */
+size_t mining_reply(struct mining_session *s, char *buf, size_t room);
+extern const struct inspector stratum_inspector;
+/* one line per worker */
+void mining_dump_workers(int fd);
+/* totals over all workers */
+void mining_dump(int fd);
+
+#endif
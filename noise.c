@@ -0,0 +1,355 @@
+#define _GNU_SOURCE
+#include "noise.h"
+#include "inspect.h"
+
+#if CONFIG_STRATUM
+#include "ec.h"
+#include "sha256.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROTOCOL "Noise_NX_Secp256k1+EllSwift_ChaChaPoly_SHA256"
+/* version, valid from, not valid after and the signature */
+#define CERT (2 + 4 + 4 + 64)
+
+#define ROTL(x, n) ((x) << (n) | (x) >> (32 - (n)))
+#define QR(a, b, c, d)                 \
+	a += b, d ^= a, d = ROTL(d, 16), \
+	c += d, b ^= c, b = ROTL(b, 12), \
+	a += b, d ^= a, d = ROTL(d, 8),  \
+	c += d, b ^= c, b = ROTL(b, 7)
+
+static uint32_t le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void chacha_block(unsigned char out[64], const unsigned char key[32], uint32_t counter,
+						 const unsigned char nonce[12])
+{
+	uint32_t in[16] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574}, x[16];
+	int i;
+	for (i = 0; i < 8; i++)
+		in[4 + i] = le32(key + 4 * i);
+	in[12] = counter;
+	for (i = 0; i < 3; i++)
+		in[13 + i] = le32(nonce + 4 * i);
+	memcpy(x, in, sizeof x);
+	for (i = 0; i < 10; i++)
+	{
+		QR(x[0], x[4], x[8], x[12]);
+		QR(x[1], x[5], x[9], x[13]);
+		QR(x[2], x[6], x[10], x[14]);
+		QR(x[3], x[7], x[11], x[15]);
+		QR(x[0], x[5], x[10], x[15]);
+		QR(x[1], x[6], x[11], x[12]);
+		QR(x[2], x[7], x[8], x[13]);
+		QR(x[3], x[4], x[9], x[14]);
+	}
+	for (i = 0; i < 16; i++)
+		put32(out + 4 * i, x[i] + in[i]);
+}
+
+static void chacha_xor(unsigned char *out, const unsigned char *in, size_t len, const unsigned char key[32],
+					   const unsigned char nonce[12])
+{
+	unsigned char ks[64];
+	uint32_t counter = 1;
+	size_t i, n;
+	for (; len; len -= n, in += n, out += n)
+	{
+		chacha_block(ks, key, counter++, nonce);
+		n = len < 64 ? len : 64;
+		for (i = 0; i < n; i++)
+			out[i] = in[i] ^ ks[i];
+	}
+}
+
+/* poly1305 in 26 bit limbs, the products fit 64 bits on 32 bit cpus */
+struct poly
+{
+	uint32_t r[5], h[5], pad[4];
+};
+
+static void poly_init(struct poly *p, const unsigned char key[32])
+{
+	int i;
+	p->r[0] = le32(key) & 0x3ffffff;
+	p->r[1] = le32(key + 3) >> 2 & 0x3ffff03;
+	p->r[2] = le32(key + 6) >> 4 & 0x3ffc0ff;
+	p->r[3] = le32(key + 9) >> 6 & 0x3f03fff;
+	p->r[4] = le32(key + 12) >> 8 & 0x00fffff;
+	memset(p->h, 0, sizeof p->h);
+	for (i = 0; i < 4; i++)
+		p->pad[i] = le32(key + 16 + 4 * i);
+}
+
+static void poly_block(struct poly *p, const unsigned char m[16], uint32_t hibit)
+{
+	const uint32_t *r = p->r;
+	uint32_t *h = p->h, s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5, c;
+	uint64_t d0, d1, d2, d3, d4;
+	h[0] += le32(m) & 0x3ffffff;
+	h[1] += le32(m + 3) >> 2 & 0x3ffffff;
+	h[2] += le32(m + 6) >> 4 & 0x3ffffff;
+	h[3] += le32(m + 9) >> 6 & 0x3ffffff;
+	h[4] += le32(m + 12) >> 8 | hibit;
+	d0 = (uint64_t)h[0] * r[0] + (uint64_t)h[1] * s4 + (uint64_t)h[2] * s3 + (uint64_t)h[3] * s2 + (uint64_t)h[4] * s1;
+	d1 = (uint64_t)h[0] * r[1] + (uint64_t)h[1] * r[0] + (uint64_t)h[2] * s4 + (uint64_t)h[3] * s3 + (uint64_t)h[4] * s2;
+	d2 = (uint64_t)h[0] * r[2] + (uint64_t)h[1] * r[1] + (uint64_t)h[2] * r[0] + (uint64_t)h[3] * s4 + (uint64_t)h[4] * s3;
+	d3 = (uint64_t)h[0] * r[3] + (uint64_t)h[1] * r[2] + (uint64_t)h[2] * r[1] + (uint64_t)h[3] * r[0] + (uint64_t)h[4] * s4;
+	d4 = (uint64_t)h[0] * r[4] + (uint64_t)h[1] * r[3] + (uint64_t)h[2] * r[2] + (uint64_t)h[3] * r[1] + (uint64_t)h[4] * r[0];
+	c = d0 >> 26, h[0] = d0 & 0x3ffffff;
+	d1 += c, c = d1 >> 26, h[1] = d1 & 0x3ffffff;
+	d2 += c, c = d2 >> 26, h[2] = d2 & 0x3ffffff;
+	d3 += c, c = d3 >> 26, h[3] = d3 & 0x3ffffff;
+	d4 += c, c = d4 >> 26, h[4] = d4 & 0x3ffffff;
+	h[0] += c * 5, c = h[0] >> 26, h[0] &= 0x3ffffff;
+	h[1] += c;
+}
+
+/* whole blocks, the last one padded with zeros like the aead wants */
+static void poly_update(struct poly *p, const unsigned char *m, size_t len)
+{
+	unsigned char last[16] = {0};
+	for (; len >= 16; len -= 16, m += 16)
+		poly_block(p, m, 1 << 24);
+	if (len)
+	{
+		memcpy(last, m, len);
+		poly_block(p, last, 1 << 24);
+	}
+}
+
+static void poly_finish(struct poly *p, unsigned char mac[16])
+{
+	uint32_t *h = p->h, g[5], c, mask;
+	uint64_t f;
+	int i;
+	c = h[1] >> 26, h[1] &= 0x3ffffff;
+	h[2] += c, c = h[2] >> 26, h[2] &= 0x3ffffff;
+	h[3] += c, c = h[3] >> 26, h[3] &= 0x3ffffff;
+	h[4] += c, c = h[4] >> 26, h[4] &= 0x3ffffff;
+	h[0] += c * 5, c = h[0] >> 26, h[0] &= 0x3ffffff;
+	h[1] += c;
+	/* h - p, taken if it does not go below zero */
+	g[0] = h[0] + 5, c = g[0] >> 26, g[0] &= 0x3ffffff;
+	for (i = 1; i < 4; i++)
+		g[i] = h[i] + c, c = g[i] >> 26, g[i] &= 0x3ffffff;
+	g[4] = h[4] + c - (1 << 26);
+	mask = (g[4] >> 31) - 1;
+	for (i = 0; i < 5; i++)
+		h[i] = (h[i] & ~mask) | (g[i] & mask);
+	h[0] = h[0] | h[1] << 26;
+	h[1] = h[1] >> 6 | h[2] << 20;
+	h[2] = h[2] >> 12 | h[3] << 14;
+	h[3] = h[3] >> 18 | h[4] << 8;
+	for (f = 0, i = 0; i < 4; i++)
+	{
+		f += (uint64_t)h[i] + p->pad[i];
+		put32(mac + 4 * i, f);
+		f >>= 32;
+	}
+}
+
+/* the mac of the aead over ad and ciphertext */
+static void aead_mac(unsigned char mac[16], const unsigned char key[32], const unsigned char nonce[12],
+					 const unsigned char *ad, size_t adlen, const unsigned char *ct, size_t len)
+{
+	unsigned char block[64], lens[16];
+	struct poly p;
+	chacha_block(block, key, 0, nonce);
+	poly_init(&p, block);
+	poly_update(&p, ad, adlen);
+	poly_update(&p, ct, len);
+	put32(lens, adlen);
+	put32(lens + 4, 0);
+	put32(lens + 8, len);
+	put32(lens + 12, 0);
+	poly_update(&p, lens, 16);
+	poly_finish(&p, mac);
+}
+
+/* noise puts the counter into the last 8 bytes of the nonce */
+static void nonce(unsigned char out[12], unsigned long long n)
+{
+	put32(out, 0);
+	put32(out + 4, n);
+	put32(out + 8, n >> 32);
+}
+
+static void encrypt_ad(struct noise_cipher *c, unsigned char *out, const unsigned char *in, size_t len,
+					   const unsigned char *ad, size_t adlen)
+{
+	unsigned char iv[12];
+	nonce(iv, c->n++);
+	chacha_xor(out, in, len, c->k, iv);
+	aead_mac(out + len, c->k, iv, ad, adlen, out, len);
+}
+
+static int decrypt_ad(struct noise_cipher *c, unsigned char *out, const unsigned char *in, size_t len,
+					  const unsigned char *ad, size_t adlen)
+{
+	unsigned char iv[12], mac[16], diff = 0;
+	int i;
+	if (len < NOISE_MAC)
+		return -1;
+	len -= NOISE_MAC;
+	nonce(iv, c->n);
+	aead_mac(mac, c->k, iv, ad, adlen, in, len);
+	for (i = 0; i < NOISE_MAC; i++)
+		diff |= mac[i] ^ in[len + i];
+	if (diff)
+		return -1;
+	c->n++;
+	chacha_xor(out, in, len, c->k, iv);
+	return 0;
+}
+
+void noise_encrypt(struct noise_cipher *c, unsigned char *out, const unsigned char *in, size_t len)
+{
+	encrypt_ad(c, out, in, len, 0, 0);
+}
+
+int noise_decrypt(struct noise_cipher *c, unsigned char *out, const unsigned char *in, size_t len)
+{
+	return decrypt_ad(c, out, in, len, 0, 0);
+}
+
+static void hmac(unsigned char out[32], const unsigned char key[32], const void *data, size_t len)
+{
+	unsigned char buf[64 + 64];
+	int i;
+	for (i = 0; i < 64; i++)
+		buf[i] = (i < 32 ? key[i] : 0) ^ 0x36;
+	memcpy(buf + 64, data, len);
+	sha256(buf, 64 + len, buf + 64);
+	for (i = 0; i < 64; i++)
+		buf[i] ^= 0x36 ^ 0x5c;
+	sha256(buf, 64 + 32, out);
+}
+
+/* ck, k = HKDF(ck, ikm) and a fresh nonce for k */
+static void mix_key(struct noise *n, const unsigned char ikm[32], struct noise_cipher *k)
+{
+	unsigned char temp[32], out[33];
+	hmac(temp, n->ck, ikm, 32);
+	out[0] = 1;
+	hmac(n->ck, temp, out, 1);
+	memcpy(out, n->ck, 32);
+	out[32] = 2;
+	hmac(k->k, temp, out, 33);
+	k->n = 0;
+}
+
+static void mix_hash(struct noise *n, const unsigned char *data, size_t len)
+{
+	unsigned char buf[32 + CERT + NOISE_MAC];
+	memcpy(buf, n->h, 32);
+	memcpy(buf + 32, data, len);
+	sha256(buf, 32 + len, n->h);
+}
+
+static int random_bytes(unsigned char *buf, size_t len)
+{
+	int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC), err;
+	ssize_t r = -1;
+	if (fd == -1)
+		return -1;
+	while (len && (r = read(fd, buf, len)) > 0)
+		buf += r, len -= r;
+	err = errno;
+	close(fd);
+	errno = r ? err : EIO;
+	return len ? -1 : 0;
+}
+
+int noise_hello(struct noise *n, unsigned char out[NOISE_HELLO])
+{
+	unsigned char rnd[32];
+	do
+	{
+		if (random_bytes(n->e, 32) || random_bytes(rnd, 32))
+			return -1;
+	} while (ec_ellswift_create(n->hello, n->e, rnd));
+	/* the name is longer than a hash, so h starts as its hash. the
+	   prologue is empty, so is the payload of this message */
+	sha256(PROTOCOL, sizeof PROTOCOL - 1, n->h);
+	memcpy(n->ck, n->h, 32);
+	mix_hash(n, (const unsigned char *)"", 0);
+	mix_hash(n, n->hello, NOISE_HELLO);
+	mix_hash(n, (const unsigned char *)"", 0);
+	memcpy(out, n->hello, NOISE_HELLO);
+	return 0;
+}
+
+int noise_reply(struct noise *n, const unsigned char in[NOISE_REPLY], const unsigned char *authority,
+				const char **why)
+{
+	const unsigned char *re = in, *rs = in + NOISE_HELLO, *cert = rs + NOISE_HELLO + NOISE_MAC;
+	unsigned char dh[32], s[NOISE_HELLO], c[CERT], m[10 + 32];
+	struct noise_cipher k;
+	unsigned from, until;
+	time_t now = time(0);
+	int ret = -1;
+	*why = "bad key";
+	/* <- e, ee, s, es and the certificate as payload */
+	mix_hash(n, re, NOISE_HELLO);
+	if (ec_ellswift_xdh(dh, n->hello, re, n->e, 1))
+		goto out;
+	mix_key(n, dh, &k);
+	*why = "handshake does not decrypt";
+	if (decrypt_ad(&k, s, rs, NOISE_HELLO + NOISE_MAC, n->h, 32))
+		goto out;
+	mix_hash(n, rs, NOISE_HELLO + NOISE_MAC);
+	if (ec_ellswift_xdh(dh, n->hello, s, n->e, 1))
+		goto out;
+	mix_key(n, dh, &k);
+	if (decrypt_ad(&k, c, cert, CERT + NOISE_MAC, n->h, 32))
+		goto out;
+	mix_hash(n, cert, CERT + NOISE_MAC);
+	/* the authority signs the hash of version, validity and the x-only
+	   static key */
+	if (authority)
+	{
+		memcpy(m, c, 10);
+		ec_ellswift_decode(m + 10, s);
+		sha256(m, sizeof m, dh);
+		from = le32(c + 2);
+		until = le32(c + 6);
+		*why = "certificate not signed by the authority";
+		if (ec_schnorr_verify(c + 10, dh, authority))
+			goto out;
+		*why = "certificate expired or not valid yet";
+		if ((unsigned long long)now < from || (unsigned long long)now > until)
+			goto out;
+	}
+	/* split: the first key sends, the second receives */
+	memset(dh, 0, sizeof dh);
+	hmac(dh, n->ck, "", 0);
+	m[0] = 1;
+	hmac(n->tx.k, dh, m, 1);
+	memcpy(m, n->tx.k, 32);
+	m[32] = 2;
+	hmac(n->rx.k, dh, m, 33);
+	n->tx.n = n->rx.n = 0;
+	ret = 0;
+out:
+	memset(n->e, 0, sizeof n->e);
+	memset(&k, 0, sizeof k);
+	return ret;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef NOISE_H
+#define NOISE_H
+
+#include <stddef.h>
+
+//RcB: DEP "noise.c"
+
+/* the noise handshake of stratum v2,
+   Noise_NX_Secp256k1+EllSwift_ChaChaPoly_SHA256, from the client's side,
+   and the ChaCha20-Poly1305 cipher states of the transport after it.
+   the client sends its ephemeral key, the pool answers with its own, its
+   static key and a certificate over the static key, signed by the pool's
+   authority key. every message of the transport is encrypted with the
+   next nonce of its direction and carries a 16 byte mac. */
+
+#define NOISE_HELLO 64
+#define NOISE_REPLY 234
+#define NOISE_MAC 16
+/* the largest encrypted message, mac included */
+#define NOISE_MAX 65535
+
+struct noise_cipher
+{
+	unsigned char k[32];
+	unsigned long long n;
+};
+
+struct noise
+{
+	unsigned char h[32], ck[32], e[32], hello[NOISE_HELLO];
+	struct noise_cipher tx, rx;
+};
+
+/* starts the handshake and writes the first message to out.
+   returns -1 with errno set if there is no randomness. */
+int noise_hello(struct noise *n, unsigned char out[NOISE_HELLO]);
+/* finishes it with the pool's answer. with an authority key (x-only, 32
+   bytes) the certificate has to be signed by it and valid now, without
+   one it is not checked. returns 0 once tx and rx are set up, or -1 and
+   the reason in why. */
+int noise_reply(struct noise *n, const unsigned char in[NOISE_REPLY], const unsigned char *authority,
+				const char **why);
+/* len bytes of in to len + NOISE_MAC bytes at out, which may be in */
+void noise_encrypt(struct noise_cipher *c, unsigned char *out, const unsigned char *in, size_t len);
+/* len bytes of in, mac included, to len - NOISE_MAC bytes at out, which
+   may be in. -1 if the mac does not match. */
+int noise_decrypt(struct noise_cipher *c, unsigned char *out, const unsigned char *in, size_t len);
+
+#endif
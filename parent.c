@@ -0,0 +1,476 @@
+#define _GNU_SOURCE
+#include "parent.h"
+#include "coro.h"
+#include "server.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+enum parent_type
+{
+	PT_SOCKS5,
+	PT_HTTP,
+};
+
+struct parent
+{
+	char name[32];
+	enum parent_type type;
+	union sockaddr_union addr;
+	socklen_t addrlen;
+	char *user, *pass;
+	unsigned poolsize;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int idle[PARENT_POOL_MAX];
+	unsigned nidle;
+	unsigned long long tunnels, pooled, failures;
+};
+
+/* username and password are limited to what rfc 1929 can carry, http
+   parents share the limit so http_connect() can size its buffers */
+#define CRED_MAX 255
+/* a socks5 domain name */
+#define HOST_MAX 255
+
+static struct parent parents[PARENT_MAX];
+static unsigned nparents;
+
+int parent_config(char *arg)
+{
+	struct parent *p = &parents[nparents];
+	char *url = strchr(arg, '='), *host, *port, *at, *opt;
+	struct addrinfo *ai;
+	if (!url || nparents == PARENT_MAX || url - arg >= (int)sizeof p->name)
+		return -1;
+	*url++ = 0;
+	strcpy(p->name, arg);
+	if (!strncmp(url, "socks5://", 9))
+		p->type = PT_SOCKS5;
+	else if (!strncmp(url, "http://", 7))
+		p->type = PT_HTTP;
+	else
+		return -1;
+	host = strstr(url, "://") + 3;
+	if ((opt = strrchr(host, ',')))
+	{
+		*opt++ = 0;
+		if (strncmp(opt, "pool=", 5))
+			return -1;
+		p->poolsize = atoi(opt + 5);
+		if (p->poolsize > PARENT_POOL_MAX)
+			p->poolsize = PARENT_POOL_MAX;
+	}
+	if ((at = strrchr(host, '@')))
+	{
+		*at = 0;
+		p->user = strdup(host);
+		if (!(p->pass = strchr(p->user, ':')))
+			return -1;
+		*p->pass++ = 0;
+		if (strlen(p->user) > CRED_MAX || strlen(p->pass) > CRED_MAX)
+			return -1;
+		host = at + 1;
+	}
+	if (*host == '[')
+	{
+		if (!(port = strchr(++host, ']')))
+			return -1;
+		*port++ = 0;
+	}
+	else
+		port = strrchr(host, ':');
+	if (!port || *port != ':')
+		return -1;
+	*port++ = 0;
+	if (resolve(host, atoi(port), &ai))
+		return -1;
+	memcpy(&p->addr, ai->ai_addr, ai->ai_addrlen);
+	p->addrlen = ai->ai_addrlen;
+	freeaddrinfo(ai);
+	pthread_mutex_init(&p->lock, 0);
+	pthread_cond_init(&p->cond, 0);
+	nparents++;
+	return 0;
+}
+
+struct parent *parent_find(const char *name)
+{
+	unsigned i;
+	for (i = 0; i < nparents; i++)
+		if (!strcmp(parents[i].name, name))
+			return &parents[i];
+	return 0;
+}
+
+/* transfer exactly n bytes, giving up after timeout_ms without progress */
+static int xfer(int fd, void *buf, size_t n, int writing, int timeout_ms)
+{
+	struct pollfd p = {.fd = fd, .events = writing ? POLLOUT : POLLIN};
+	char *b = buf;
+	while (n)
+	{
+		ssize_t r = writing ? write(fd, b, n) : read(fd, b, n);
+		if (r > 0)
+		{
+			b += r;
+			n -= r;
+			continue;
+		}
+		if (r == 0)
+		{
+			errno = ECONNRESET;
+			return -1;
+		}
+		if (errno != EAGAIN && errno != EINTR)
+			return -1;
+		if ((r = coro_poll(&p, 1, timeout_ms)) <= 0)
+		{
+			if (r == 0)
+				errno = ETIMEDOUT;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* socks5 greeting and username/password authentication (rfc 1929) */
+static int socks5_greet(struct parent *p, int fd, int timeout_ms)
+{
+	unsigned char buf[515];
+	size_t ul, pl;
+	if (xfer(fd, (void *)(p->user ? "\5\2\0\2" : "\5\1\0"), p->user ? 4 : 3, 1, timeout_ms) ||
+		xfer(fd, buf, 2, 0, timeout_ms))
+		return -1;
+	if (buf[0] != 5 || (buf[1] != 0 && (buf[1] != 2 || !p->user)))
+	{
+		errno = EACCES;
+		return -1;
+	}
+	if (buf[1] == 0)
+		return 0;
+	ul = strlen(p->user);
+	pl = strlen(p->pass);
+	if (ul > CRED_MAX || pl > CRED_MAX)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	buf[0] = 1;
+	buf[1] = ul;
+	memcpy(buf + 2, p->user, ul);
+	buf[2 + ul] = pl;
+	memcpy(buf + 3 + ul, p->pass, pl);
+	if (xfer(fd, buf, 3 + ul + pl, 1, timeout_ms) || xfer(fd, buf, 2, 0, timeout_ms))
+		return -1;
+	if (buf[1] != 0)
+	{
+		errno = EACCES;
+		return -1;
+	}
+	return 0;
+}
+
+/* a new connection to p which is ready for a CONNECT request */
+static int dial(struct parent *p, int timeout_ms)
+{
+	int err, fd = socket(p->addr.v4.sin_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+	socklen_t errlen = sizeof err;
+	if (fd == -1)
+		return -1;
+	if (connect(fd, (void *)&p->addr, p->addrlen) == -1)
+	{
+		if (errno != EINPROGRESS)
+			goto fail;
+		if ((err = coro_poll(&pfd, 1, timeout_ms)) <= 0)
+		{
+			if (err == 0)
+				errno = ETIMEDOUT;
+			goto fail;
+		}
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1)
+			goto fail;
+		if (err)
+		{
+			errno = err;
+			goto fail;
+		}
+	}
+	if (p->type == PT_SOCKS5 && socks5_greet(p, fd, timeout_ms))
+		goto fail;
+	return fd;
+fail:
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+/* an idle connection must neither have been closed nor have sent anything */
+static int alive(int fd)
+{
+	char c;
+	return recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == -1 && errno == EAGAIN;
+}
+
+static int pool_take(struct parent *p)
+{
+	int fd = -1;
+	pthread_mutex_lock(&p->lock);
+	while (fd == -1 && p->nidle)
+	{
+		fd = p->idle[--p->nidle];
+		if (!alive(fd))
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	pthread_cond_signal(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+	return fd;
+}
+
+static void pool_prune(struct parent *p)
+{
+	unsigned i, n = 0;
+	for (i = 0; i < p->nidle; i++)
+	{
+		if (alive(p->idle[i]))
+			p->idle[n++] = p->idle[i];
+		else
+			close(p->idle[i]);
+	}
+	p->nidle = n;
+}
+
+static void *refill(void *data)
+{
+	struct parent *p = data;
+	struct timespec ts;
+	int fd;
+	for (;;)
+	{
+		pthread_mutex_lock(&p->lock);
+		while (p->nidle >= p->poolsize)
+		{
+			/* parents close idle connections after a while */
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += 10;
+			if (pthread_cond_timedwait(&p->cond, &p->lock, &ts) == ETIMEDOUT)
+				pool_prune(p);
+		}
+		pthread_mutex_unlock(&p->lock);
+		if ((fd = dial(p, 6000)) == -1)
+		{
+			__atomic_add_fetch(&p->failures, 1, __ATOMIC_RELAXED);
+			sleep(1);
+			continue;
+		}
+		pthread_mutex_lock(&p->lock);
+		p->idle[p->nidle++] = fd;
+		pthread_mutex_unlock(&p->lock);
+	}
+	return 0;
+}
+
+int parent_start(void)
+{
+	unsigned i;
+	pthread_t pt;
+	for (i = 0; i < nparents; i++)
+	{
+		if (!parents[i].poolsize)
+			continue;
+		if (pthread_create(&pt, 0, refill, &parents[i]))
+			return -1;
+		pthread_detach(pt);
+	}
+	return 0;
+}
+
+static int socks5_connect(int fd, const char *host, unsigned short port, int timeout_ms)
+{
+	static const int errors[] = {0, EIO, EACCES, ENETUNREACH, EHOSTUNREACH,
+								 ECONNREFUSED, ETIMEDOUT, EOPNOTSUPP, EAFNOSUPPORT};
+	unsigned char buf[4 + 256 + 2];
+	size_t l = strlen(host), skip;
+	if (l > 255)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(buf, "\5\1\0\3", 4);
+	/* send address literals as such, parents may not resolve them */
+	if (inet_pton(AF_INET, host, buf + 4) == 1)
+		buf[3] = 1, l = 4;
+	else if (inet_pton(AF_INET6, host, buf + 4) == 1)
+		buf[3] = 4, l = 16;
+	else
+	{
+		buf[4] = l;
+		memcpy(buf + 5, host, l++);
+	}
+	buf[4 + l] = port >> 8;
+	buf[5 + l] = port & 0xff;
+	if (xfer(fd, buf, 6 + l, 1, timeout_ms) || xfer(fd, buf, 5, 0, timeout_ms))
+		return -1;
+	if (buf[0] != 5 || buf[1] != 0)
+	{
+		errno = buf[0] == 5 && buf[1] < sizeof errors / sizeof *errors ? errors[buf[1]] : EIO;
+		return -1;
+	}
+	/* skip the bound address, we already have its first byte */
+	switch (buf[3])
+	{
+	case 1:
+		skip = 4 - 1 + 2;
+		break;
+	case 4:
+		skip = 16 - 1 + 2;
+		break;
+	case 3:
+		skip = buf[4] + 2;
+		break;
+	default:
+		errno = EPROTO;
+		return -1;
+	}
+	return xfer(fd, buf, skip, 0, timeout_ms);
+}
+
+static void base64(char *out, const unsigned char *in, size_t n)
+{
+	static const char tab[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	for (; n >= 3; n -= 3, in += 3)
+	{
+		*out++ = tab[in[0] >> 2];
+		*out++ = tab[(in[0] & 3) << 4 | in[1] >> 4];
+		*out++ = tab[(in[1] & 15) << 2 | in[2] >> 6];
+		*out++ = tab[in[2] & 63];
+	}
+	if (n)
+	{
+		*out++ = tab[in[0] >> 2];
+		*out++ = tab[(in[0] & 3) << 4 | (n > 1 ? in[1] >> 4 : 0)];
+		*out++ = n > 1 ? tab[(in[1] & 15) << 2] : '=';
+		*out++ = '=';
+	}
+	*out = 0;
+}
+
+static int http_connect(struct parent *p, int fd, const char *host, unsigned short port, int timeout_ms)
+{
+	char cred[2 * CRED_MAX + 2], *end;
+	char auth[sizeof "Proxy-Authorization: Basic \r\n" + (sizeof cred + 2) / 3 * 4];
+	char req[2 * HOST_MAX + 64 + sizeof auth];
+	int n, status, v6 = !!strchr(host, ':');
+	auth[0] = 0;
+	if (p->user)
+	{
+		n = snprintf(cred, sizeof cred, "%s:%s", p->user, p->pass);
+		if (n < 0 || n >= (int)sizeof cred)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		memcpy(auth, "Proxy-Authorization: Basic ", 27);
+		base64(auth + 27, (unsigned char *)cred, n);
+		strcat(auth, "\r\n");
+	}
+	n = snprintf(req, sizeof req, "CONNECT %s%s%s:%u HTTP/1.1\r\nHost: %s%s%s:%u\r\n%s\r\n",
+				 v6 ? "[" : "", host, v6 ? "]" : "", port, v6 ? "[" : "", host, v6 ? "]" : "", port, auth);
+	if (n < 0 || n >= (int)sizeof req)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if (xfer(fd, req, n, 1, timeout_ms))
+		return -1;
+	/* peek for the end of the response header, so no tunnel data is eaten */
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+	size_t have = 0;
+	for (;;)
+	{
+		n = recv(fd, req + have, sizeof req - 1 - have, MSG_PEEK);
+		if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR))
+		{
+			if (n == 0)
+				errno = ECONNRESET;
+			return -1;
+		}
+		if (n > 0)
+		{
+			req[have + n] = 0;
+			if ((end = strstr(req, "\r\n\r\n")))
+			{
+				if (xfer(fd, req + have, end + 4 - req - have, 0, timeout_ms))
+					return -1;
+				break;
+			}
+			if (have + n == sizeof req - 1)
+			{
+				errno = EPROTO;
+				return -1;
+			}
+			/* all header, consume it */
+			if (xfer(fd, req + have, n, 0, timeout_ms))
+				return -1;
+			have += n;
+			continue;
+		}
+		if ((n = coro_poll(&pfd, 1, timeout_ms)) <= 0)
+		{
+			if (n == 0)
+				errno = ETIMEDOUT;
+			return -1;
+		}
+	}
+	if (sscanf(req, "HTTP/1.%*d %d", &status) != 1)
+		status = 0;
+	if (status / 100 == 2)
+		return 0;
+	errno = status == 403 || status == 407 ? EACCES : status == 502 ? EHOSTUNREACH : status == 504 ? ETIMEDOUT : EIO;
+	return -1;
+}
+
+int parent_connect(struct parent *p, const char *host, unsigned short port, int timeout_ms)
+{
+	int err, fd = p->poolsize ? pool_take(p) : -1;
+	if (fd != -1)
+		__atomic_add_fetch(&p->pooled, 1, __ATOMIC_RELAXED);
+	else if ((fd = dial(p, timeout_ms)) == -1)
+	{
+		__atomic_add_fetch(&p->failures, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	__atomic_add_fetch(&p->tunnels, 1, __ATOMIC_RELAXED);
+	if ((p->type == PT_SOCKS5 ? socks5_connect(fd, host, port, timeout_ms) : http_connect(p, fd, host, port, timeout_ms)) == 0)
+		return fd;
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+void parent_dump(int fd)
+{
+	unsigned i;
+	for (i = 0; i < nparents; i++)
+	{
+		struct parent *p = &parents[i];
+		pthread_mutex_lock(&p->lock);
+		unsigned idle = p->nidle;
+		pthread_mutex_unlock(&p->lock);
+		dprintf(fd, "parent %s: tunnels %llu from pool %llu, idle %u/%u, failed dials %llu\n", p->name,
+				__atomic_load_n(&p->tunnels, __ATOMIC_RELAXED),
+				__atomic_load_n(&p->pooled, __ATOMIC_RELAXED), idle, p->poolsize,
+				__atomic_load_n(&p->failures, __ATOMIC_RELAXED));
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef PARENT_H
+#define PARENT_H
+
+//RcB: DEP "parent.c"
+
+/* parent proxies: tunnels can be routed through an upstream SOCKS5 or
+   HTTP CONNECT proxy instead of connecting directly. which destinations
+   go where is decided by "via" rules in the acl file.
+   a thread per parent keeps a pool of idle connections which already did
+   the tcp handshake and the socks greeting and authentication, so a new
+   tunnel only costs the CONNECT request. */
+
+#define PARENT_MAX 16
+#define PARENT_POOL_MAX 256
+
+struct parent;
+
+/* parse "name=socks5://[user:pass@]host:port[,pool=N]", or with http://
+   for a CONNECT proxy. returns 0 on success. */
+int parent_config(char *arg);
+struct parent *parent_find(const char *name);
+/* start the pool threads, call once signals are set up */
+int parent_start(void);
+/* open a tunnel to host:port through p. returns a non-blocking fd,
+   or -1 with errno set to the closest match of the parent's reply. */
+int parent_connect(struct parent *p, const char *host, unsigned short port, int timeout_ms);
+void parent_dump(int fd);
+
+#endif
@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include "ratelimit.h"
+#include "utils.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RL_BUCKETS 1024
+
+enum rl_class
+{
+	RLC_IP,
+	RLC_USER,
+	RLC_GLOBAL,
+	RLC_MAX,
+};
+
+struct bucket
+{
+	long long tokens;
+	long long last_us;
+};
+
+struct rl_entry
+{
+	struct rl_entry *next;
+	pthread_spinlock_t lock;
+	unsigned refs;
+	enum rl_class cls;
+	struct bucket b[2];
+	size_t keylen;
+	unsigned char key[];
+};
+
+/* bytes per second per class and direction, 0 means unlimited */
+static unsigned long long rate[RLC_MAX][2];
+static unsigned long long burst;
+static int enabled;
+static struct rl_entry *global;
+static struct rl_entry *table[RL_BUCKETS];
+static pthread_mutex_t table_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long long now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static unsigned long long bucket_size(enum rl_class cls, int dir)
+{
+	return burst ? burst : rate[cls][dir];
+}
+
+static struct rl_entry *entry_new(enum rl_class cls, const void *key, size_t keylen)
+{
+	struct rl_entry *e = calloc(1, sizeof *e + keylen);
+	if (!e)
+		return 0;
+	pthread_spin_init(&e->lock, PTHREAD_PROCESS_PRIVATE);
+	e->refs = 1;
+	e->cls = cls;
+	e->keylen = keylen;
+	memcpy(e->key, key, keylen);
+	e->b[0].tokens = bucket_size(cls, 0);
+	e->b[1].tokens = bucket_size(cls, 1);
+	e->b[0].last_us = e->b[1].last_us = now_us();
+	return e;
+}
+
+int ratelimit_config(char *opts)
+{
+	char *const keys[] = {"ip", "user", "global", "burst", 0};
+	char *value, *end;
+	while (*opts)
+	{
+		int i = getsubopt(&opts, keys, &value);
+		if (i < 0 || !value)
+			return -1;
+		if (i == 3)
+		{
+			burst = parse_size(value, &end);
+			continue;
+		}
+		rate[i][RL_UP] = rate[i][RL_DOWN] = parse_size(value, &end);
+		if (*end == '/')
+			rate[i][RL_DOWN] = parse_size(end + 1, &end);
+		if (*end)
+			return -1;
+		enabled |= rate[i][RL_UP] || rate[i][RL_DOWN];
+	}
+	if ((rate[RLC_GLOBAL][RL_UP] || rate[RLC_GLOBAL][RL_DOWN]) &&
+		!(global = entry_new(RLC_GLOBAL, "", 0)))
+		return -1;
+	return 0;
+}
+
+int ratelimit_enabled(void)
+{
+	return enabled;
+}
+
+static unsigned key_hash(enum rl_class cls, const unsigned char *key, size_t len)
+{
+	unsigned h = 2166136261u ^ cls;
+	while (len--)
+		h = (h ^ *key++) * 16777619u;
+	return h % RL_BUCKETS;
+}
+
+static struct rl_entry *entry_get(enum rl_class cls, const void *key, size_t keylen)
+{
+	struct rl_entry **pp, *e;
+	if (!rate[cls][RL_UP] && !rate[cls][RL_DOWN])
+		return 0;
+	pthread_mutex_lock(&table_mutex);
+	for (pp = &table[key_hash(cls, key, keylen)]; (e = *pp); pp = &e->next)
+	{
+		if (e->cls == cls && e->keylen == keylen && !memcmp(e->key, key, keylen))
+		{
+			e->refs++;
+			break;
+		}
+	}
+	if (!e && (e = entry_new(cls, key, keylen)))
+		*pp = e;
+	pthread_mutex_unlock(&table_mutex);
+	return e;
+}
+
+static void entry_put(struct rl_entry *e)
+{
+	struct rl_entry **pp;
+	if (!e)
+		return;
+	pthread_mutex_lock(&table_mutex);
+	if (!--e->refs)
+	{
+		for (pp = &table[key_hash(e->cls, e->key, e->keylen)]; *pp != e; pp = &(*pp)->next)
+			;
+		*pp = e->next;
+		pthread_spin_destroy(&e->lock);
+		free(e);
+	}
+	pthread_mutex_unlock(&table_mutex);
+}
+
+void ratelimit_attach(struct rl_session *s, const union sockaddr_union *addr, const char *user)
+{
+	size_t len;
+	const void *ip = sockaddr_ip(addr, &len);
+	s->ip = entry_get(RLC_IP, ip, len);
+	s->user = user ? entry_get(RLC_USER, user, strlen(user)) : 0;
+}
+
+void ratelimit_detach(struct rl_session *s)
+{
+	entry_put(s->ip);
+	entry_put(s->user);
+	s->ip = s->user = 0;
+}
+
+/* returns the available tokens, the caller holds e->lock. refill only
+   advances the clock by the time actually converted to tokens, so frequent
+   calls at low rates don't lose the fractions. */
+static long long refill(struct rl_entry *e, int dir, long long now)
+{
+	struct bucket *b = &e->b[dir];
+	unsigned long long r = rate[e->cls][dir];
+	long long cap = bucket_size(e->cls, dir), elapsed = now - b->last_us;
+	if (elapsed > 60 * 1000000LL)
+		elapsed = 60 * 1000000LL;
+	long long add = elapsed * r / 1000000;
+	if (add > 0)
+	{
+		b->tokens += add;
+		b->last_us += add * 1000000 / r;
+	}
+	if (b->tokens >= cap)
+	{
+		b->tokens = cap;
+		b->last_us = now;
+	}
+	return b->tokens;
+}
+
+size_t ratelimit_allow(struct rl_session *s, enum rl_dir dir, size_t want, int *wait_ms)
+{
+	struct rl_entry *e[3] = {s->ip, s->user, global};
+	long long now = now_us();
+	int i, wait = 0;
+	for (i = 0; i < 3; i++)
+	{
+		if (!e[i] || !rate[e[i]->cls][dir])
+			continue;
+		pthread_spin_lock(&e[i]->lock);
+		long long avail = refill(e[i], dir, now);
+		pthread_spin_unlock(&e[i]->lock);
+		if (avail <= 0)
+		{
+			/* time until at least one token is there, rounded up to 1ms */
+			long long ms = ((1 - avail) * 1000000 / rate[e[i]->cls][dir]) / 1000 + 1;
+			if (ms > wait)
+				wait = ms > 1000 ? 1000 : ms;
+			want = 0;
+		}
+		else if ((unsigned long long)avail < want)
+			want = avail;
+	}
+	*wait_ms = wait;
+	return want;
+}
+
+void ratelimit_consume(struct rl_session *s, enum rl_dir dir, size_t n)
+{
+	struct rl_entry *e[3] = {s->ip, s->user, global};
+	int i;
+	for (i = 0; i < 3; i++)
+	{
+		if (!e[i] || !rate[e[i]->cls][dir])
+			continue;
+		pthread_spin_lock(&e[i]->lock);
+		e[i]->b[dir].tokens -= n;
+		pthread_spin_unlock(&e[i]->lock);
+	}
+}
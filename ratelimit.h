@@ -0,0 +1,41 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stddef.h>
+#include "server.h"
+
+//RcB: DEP "ratelimit.c"
+
+/* token bucket bandwidth shaping. every session draws from up to three
+   buckets per direction: one shared by its source ip, one shared by its
+   authenticated user and a global one. the relay loop asks how much it
+   may read before reading, and stops polling a socket for input while
+   the buckets are empty, so nothing gets buffered. */
+
+enum rl_dir
+{
+	RL_UP = 0,	 /* client -> remote */
+	RL_DOWN = 1, /* remote -> client */
+};
+
+struct rl_entry;
+
+struct rl_session
+{
+	struct rl_entry *ip;
+	struct rl_entry *user;
+};
+
+/* parse a getsubopt(3) list like "ip=1m/4m,user=8m,global=100m,burst=256k".
+   rates are bytes per second for upload/download, a single value applies
+   to both directions. burst defaults to one second worth of rate. */
+int ratelimit_config(char *opts);
+int ratelimit_enabled(void);
+void ratelimit_attach(struct rl_session *s, const union sockaddr_union *addr, const char *user);
+void ratelimit_detach(struct rl_session *s);
+/* returns how many of want bytes may be transferred in direction dir right
+   now. if that's 0, *wait_ms is set to the time until tokens are available. */
+size_t ratelimit_allow(struct rl_session *s, enum rl_dir dir, size_t want, int *wait_ms);
+void ratelimit_consume(struct rl_session *s, enum rl_dir dir, size_t n);
+
+#endif
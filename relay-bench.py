@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+# download throughput through the relay, e.g. the copy loop against -K:
+#   ./microsocks -p 1080 & ./relay-bench.py 1080 2000 3 $!
+#   ./microsocks -p 1081 -K 64 & ./relay-bench.py 1081 2000 3 $!
+# a source of its own on 127.0.0.1 sends MB megabytes per run, the sink reads
+# them through the proxy and reports MB/s. with the pid of the proxy, the cpu
+# ticks it used over all runs are reported too. for reference the same runs
+# go straight to the source and through a splice(2) forwarder in this script;
+# microsocks itself has no splice path.
+import os, socket, struct, sys, threading, time
+
+CHUNK = 1 << 20
+
+def listen():
+	s = socket.socket()
+	s.bind(('127.0.0.1', 0))
+	s.listen(64)
+	return s
+
+def serve(ls, handler):
+	def run():
+		while True:
+			c, _ = ls.accept()
+			threading.Thread(target=handler, args=(c,), daemon=True).start()
+	threading.Thread(target=run, daemon=True).start()
+	return ls.getsockname()[1]
+
+def source(c):
+	data = b'x' * CHUNK
+	n = int(c.recv(64))
+	for i in range(n):
+		c.sendall(data)
+	c.close()
+
+def splicer(srcport):
+	def forward(c):
+		u = socket.create_connection(('127.0.0.1', srcport))
+		def pump(a, b):
+			r, w = os.pipe()
+			try:
+				while True:
+					n = os.splice(a.fileno(), w, CHUNK)
+					if not n:
+						break
+					while n:
+						n -= os.splice(r, b.fileno(), n)
+				b.shutdown(socket.SHUT_WR)
+			except OSError:
+				pass
+			os.close(r)
+			os.close(w)
+		t = threading.Thread(target=pump, args=(c, u), daemon=True)
+		t.start()
+		pump(u, c)
+		t.join()
+		c.close()
+		u.close()
+	return forward
+
+def download(port, srcport, mb, socks):
+	s = socket.create_connection(('127.0.0.1', port))
+	if socks:
+		s.sendall(b'\5\1\0')
+		s.recv(2)
+		s.sendall(b'\5\1\0\1' + socket.inet_aton('127.0.0.1') + struct.pack('>H', srcport))
+		if s.recv(10)[1] != 0:
+			sys.exit('the proxy refused the tunnel')
+	t = time.monotonic()
+	s.sendall(b'%d' % mb)
+	got, buf = 0, bytearray(CHUNK)
+	while True:
+		n = s.recv_into(buf)
+		if not n:
+			break
+		got += n
+	t = time.monotonic() - t
+	s.close()
+	if got != mb * CHUNK:
+		sys.exit('short download: %d of %d bytes' % (got, mb * CHUNK))
+	return got / t / 1e6
+
+def ticks(pid):
+	with open('/proc/%d/stat' % pid) as f:
+		fields = f.read().rsplit(')', 1)[1].split()
+	return int(fields[11]) + int(fields[12])
+
+def main():
+	if len(sys.argv) < 2:
+		sys.exit('usage: %s proxyport [MB] [runs] [pid]' % sys.argv[0])
+	proxy = int(sys.argv[1])
+	mb = int(sys.argv[2]) if len(sys.argv) > 2 else 1000
+	runs = int(sys.argv[3]) if len(sys.argv) > 3 else 3
+	pid = int(sys.argv[4]) if len(sys.argv) > 4 else 0
+	src = serve(listen(), source)
+	spl = serve(listen(), splicer(src))
+	for name, port, socks in (('direct', src, 0), ('splice', spl, 0), ('proxy', proxy, 1)):
+		before = ticks(pid) if pid and socks else 0
+		rates = [download(port, src, mb, socks) for i in range(runs)]
+		line = '%-7s %s MB/s' % (name, ' '.join('%.0f' % r for r in rates))
+		if pid and socks:
+			line += ', %d ticks of cpu' % (ticks(pid) - before)
+		print(line)
+
+main()
@@ -1,7 +1,31 @@
+#define _GNU_SOURCE
 #include "server.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+const void *sockaddr_ip(const union sockaddr_union *addr, size_t *len)
+{
+	/* an empty key, which no ip address can collide with */
+	if (addr->v4.sin_family == AF_UNIX)
+	{
+		*len = 0;
+		return addr;
+	}
+	if (addr->v4.sin_family == AF_INET6)
+	{
+		*len = 16;
+		return &addr->v6.sin6_addr;
+	}
+	*len = 4;
+	return &addr->v4.sin_addr;
+}
 
 int resolve(const char *host, unsigned short port, struct addrinfo **addr)
 {
@@ -22,13 +46,27 @@ int server_bindtoip(const struct server *server, int fd)
 	return 0;
 }
 
-int server_waitclient(struct server *server, struct client *client)
+int server_acceptclients(struct server *server, struct client *clients, int max)
 {
-	socklen_t clen = sizeof client->addr;
-	return ((client->fd = accept(server->fd, (void *)&client->addr, &clen)) == -1) * -1;
+	int n = 0;
+	while (n < max)
+	{
+		socklen_t clen = sizeof clients[n].addr;
+		int fd = accept4(server->fd, (void *)&clients[n].addr, &clen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1)
+			break;
+		/* the path of a unix client doesn't fit, only its family is kept */
+		if (clients[n].addr.v4.sin_family == AF_UNIX)
+		{
+			memset(&clients[n].addr, 0, sizeof clients[n].addr);
+			clients[n].addr.v4.sin_family = AF_UNIX;
+		}
+		clients[n++].fd = fd;
+	}
+	return n ? n : -1;
 }
 
-int server_setup(struct server *server, const char *listenip, unsigned short port)
+int server_setup(struct server *server, const char *listenip, unsigned short port, int backlog)
 {
 	struct addrinfo *ainfo = 0;
 	if (resolve(listenip, port, &ainfo))
@@ -52,12 +90,37 @@ int server_setup(struct server *server, const char *listenip, unsigned short por
 	if (listenfd < 0)
 		return -2;
 	freeaddrinfo(ainfo);
-	if (listen(listenfd, SOMAXCONN) < 0)
+	if (listen(listenfd, backlog) < 0)
 	{
 		close(listenfd);
 		return -3;
 	}
-	server->fd = listenfd;
+	return server_adopt(server, listenfd, listenip);
+}
+
+int server_listens_on(int fd, const char *listenip, unsigned short port)
+{
+	union sockaddr_union sa;
+	socklen_t len = sizeof sa;
+	struct addrinfo *ainfo, *p;
+	size_t iplen, want;
+	int ret = 0;
+	if (getsockname(fd, (void *)&sa, &len) || (sa.v4.sin_family != AF_INET && sa.v4.sin_family != AF_INET6) ||
+		ntohs(sa.v4.sin_port) != port || resolve(listenip, port, &ainfo))
+		return 0;
+	const void *ip = sockaddr_ip(&sa, &iplen);
+	for (p = ainfo; p && !ret; p = p->ai_next)
+		ret = p->ai_family == sa.v4.sin_family &&
+			  !memcmp(ip, sockaddr_ip((void *)p->ai_addr, &want), iplen);
+	freeaddrinfo(ainfo);
+	return ret;
+}
+
+int server_adopt(struct server *server, int fd, const char *listenip)
+{
+	struct addrinfo *ainfo;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	server->fd = fd;
 	if (!resolve(listenip, 0, &ainfo))
 	{
 		server->bindaddrsz = ainfo->ai_addrlen;
@@ -68,3 +131,129 @@ int server_setup(struct server *server, const char *listenip, unsigned short por
 		server->bindaddr.v4.sin_family = AF_UNSPEC;
 	return 0;
 }
+
+int server_fastopen(const struct server *server, int qlen)
+{
+#ifdef TCP_FASTOPEN
+	return setsockopt(server->fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof qlen);
+#else
+	return -1;
+#endif
+}
+
+int socket_fastopened(int fd)
+{
+#ifdef TCPI_OPT_SYN_DATA
+	struct tcp_info ti;
+	socklen_t len = sizeof ti;
+	if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == 0)
+		return !!(ti.tcpi_options & TCPI_OPT_SYN_DATA);
+#endif
+	return 0;
+}
+
+int server_backlog(const struct server *server, unsigned *queued, unsigned *max)
+{
+#ifdef TCP_INFO
+	/* for a listening socket linux reports the accept queue in these fields */
+	struct tcp_info ti;
+	socklen_t len = sizeof ti;
+	if (getsockopt(server->fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == 0)
+	{
+		*queued = ti.tcpi_unacked;
+		*max = ti.tcpi_sacked;
+		return 0;
+	}
+#endif
+	return -1;
+}
+
+int server_listen_drops(unsigned long long *overflows, unsigned long long *drops)
+{
+	/* /proc/net/netstat has pairs of lines, the field names and their values */
+	char names[4096], values[4096];
+	int ret = -1;
+	FILE *f = fopen("/proc/net/netstat", "r");
+	if (!f)
+		return -1;
+	while (fgets(names, sizeof names, f) && fgets(values, sizeof values, f))
+	{
+		if (strncmp(names, "TcpExt:", 7))
+			continue;
+		char *np, *vp, *n = strtok_r(names, " \n", &np), *v = strtok_r(values, " \n", &vp);
+		while ((n = strtok_r(0, " \n", &np)) && (v = strtok_r(0, " \n", &vp)))
+		{
+			if (!strcmp(n, "ListenOverflows"))
+				*overflows = strtoull(v, 0, 10);
+			else if (!strcmp(n, "ListenDrops"))
+			{
+				*drops = strtoull(v, 0, 10);
+				ret = 0;
+			}
+		}
+		break;
+	}
+	fclose(f);
+	return ret;
+}
+
+socklen_t unix_addr(struct sockaddr_un *sun, const char *path)
+{
+	size_t len = strlen(path);
+	memset(sun, 0, sizeof *sun);
+	sun->sun_family = AF_UNIX;
+	if (len >= sizeof sun->sun_path)
+		return 0;
+	memcpy(sun->sun_path, path, len);
+	if (path[0] == '@')
+	{
+		sun->sun_path[0] = 0;
+		return offsetof(struct sockaddr_un, sun_path) + len;
+	}
+	return offsetof(struct sockaddr_un, sun_path) + len + 1;
+}
+
+int unix_listen(const char *path, int backlog, unsigned mode)
+{
+	struct sockaddr_un sun;
+	socklen_t len = unix_addr(&sun, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (!len || fd == -1)
+		return -1;
+	if (path[0] != '@')
+		unlink(path);
+	/* the socket file is created with mode, a chmod() afterwards would
+	   leave a window in which anyone could connect */
+	mode_t mask = umask(~mode & 0777);
+	int ret = bind(fd, (void *)&sun, len);
+	umask(mask);
+	if (ret == -1 || listen(fd, backlog) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int unix_listens_on(int fd, const char *path)
+{
+	struct sockaddr_un sun, want;
+	socklen_t len = sizeof sun, wantlen = unix_addr(&want, path);
+	return !getsockname(fd, (void *)&sun, &len) && sun.sun_family == AF_UNIX &&
+		   len == wantlen && !memcmp(&sun, &want, len);
+}
+
+int unix_peer_ours(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof cred;
+	return !getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) && cred.uid == geteuid();
+}
+
+int server_setup_unix(struct server *server, const char *path, int backlog, unsigned mode, const char *listenip)
+{
+	int fd = unix_listen(path, backlog, mode);
+	if (fd == -1)
+		return -1;
+	return server_adopt(server, fd, listenip);
+}
@@ -26,10 +26,43 @@ struct server {
 	socklen_t bindaddrsz;
 };
 
+/* returns a pointer to the raw ip address bytes of addr and stores their count in len.
+   clients on a unix socket have the family AF_UNIX and an empty address. */
+const void *sockaddr_ip(const union sockaddr_union *addr, size_t *len);
 int resolve(const char *host, unsigned short port, struct addrinfo** addr);
 int server_bindtoip(const struct server *server, int fd);
-int server_waitclient(struct server *server, struct client* client);
-int server_setup(struct server *server, const char* listenip, unsigned short port);
+/* accepts up to max pending clients from the non-blocking listener as
+   non-blocking sockets. returns their number, or -1. */
+int server_acceptclients(struct server *server, struct client* clients, int max);
+int server_setup(struct server *server, const char* listenip, unsigned short port, int backlog);
+/* nonzero if the socket fd is bound to port on the address listenip resolves to */
+int server_listens_on(int fd, const char *listenip, unsigned short port);
+/* use the already listening socket fd, e.g. one inherited from another process */
+int server_adopt(struct server *server, int fd, const char* listenip);
+/* enable tcp fast open on the listening socket with a queue of qlen pending requests */
+int server_fastopen(const struct server *server, int qlen);
+/* nonzero if data carried in the SYN of the connection on fd was acked */
+int socket_fastopened(int fd);
+/* current and maximum length of the accept queue, -1 if unsupported */
+int server_backlog(const struct server *server, unsigned *queued, unsigned *max);
+/* system wide TcpExt ListenOverflows and ListenDrops counters */
+int server_listen_drops(unsigned long long *overflows, unsigned long long *drops);
+
+struct sockaddr_un;
+/* fill in the address of the unix socket path, a leading '@' denotes the
+   abstract namespace. returns the address length, 0 if path is too long. */
+socklen_t unix_addr(struct sockaddr_un *sun, const char *path);
+/* listen on the unix socket path, replacing a stale one, with the
+   permissions mode (ignored for abstract sockets). returns its fd or -1. */
+int unix_listen(const char *path, int backlog, unsigned mode);
+/* nonzero if the socket fd is bound to the unix socket path */
+int unix_listens_on(int fd, const char *path);
+/* nonzero if the peer of the unix socket fd runs as our effective user.
+   abstract sockets have no permissions, so this is their only check. */
+int unix_peer_ours(int fd);
+/* listen for clients on the unix socket path. outgoing connections are
+   still bound to listenip in bind mode. */
+int server_setup_unix(struct server *server, const char *path, int backlog, unsigned mode, const char *listenip);
 
 #endif
 
@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+#include "inspect.h"
+#include "sha256.h"
+
+#if CONFIG_STRATUM
+#include <stdint.h>
+#include <string.h>
+
+/* the sha extensions are used where gcc can target them, build with
+   -DCONFIG_SHANI=0 to leave them out. */
+#ifndef CONFIG_SHANI
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CONFIG_SHANI 1
+#else
+#define CONFIG_SHANI 0
+#endif
+#endif
+
+#if CONFIG_SHANI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t H0[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+#define ROR(x, n) ((x) >> (n) | (x) << (32 - (n)))
+
+static void blocks_generic(uint32_t state[8], const unsigned char *data, size_t n)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+	for (; n--; data += 64)
+	{
+		for (i = 0; i < 16; i++)
+			w[i] = (uint32_t)data[4 * i] << 24 | (uint32_t)data[4 * i + 1] << 16 |
+				   (uint32_t)data[4 * i + 2] << 8 | data[4 * i + 3];
+		for (; i < 64; i++)
+			w[i] = (ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ w[i - 2] >> 10) + w[i - 7] +
+				   (ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ w[i - 15] >> 3) + w[i - 16];
+		a = state[0], b = state[1], c = state[2], d = state[3];
+		e = state[4], f = state[5], g = state[6], h = state[7];
+		for (i = 0; i < 64; i++)
+		{
+			t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+			t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g, g = f, f = e, e = d + t1;
+			d = c, c = b, b = a, a = t1 + t2;
+		}
+		state[0] += a, state[1] += b, state[2] += c, state[3] += d;
+		state[4] += e, state[5] += f, state[6] += g, state[7] += h;
+	}
+}
+
+#if CONFIG_SHANI
+/* the state lives in two registers as ABEF and CDGH, each sha256rnds2
+   does two rounds, sha256msg1/2 extend the message four words at a time. */
+__attribute__((target("sha,sse4.1"))) static void blocks_shani(uint32_t state[8], const unsigned char *data, size_t n)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i s0, s1, t, abef, cdgh, m[4];
+	int g;
+
+	t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xb1);
+	s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1b);
+	s0 = _mm_alignr_epi8(t, s1, 8);
+	s1 = _mm_blend_epi16(s1, t, 0xf0);
+	for (; n--; data += 64)
+	{
+		abef = s0;
+		cdgh = s1;
+		for (g = 0; g < 16; g++)
+		{
+			if (g < 4)
+				m[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * g)), bswap);
+			else
+			{
+				/* w[t] = s1(w[t-2]) + w[t-7] + s0(w[t-15]) + w[t-16] */
+				t = _mm_sha256msg1_epu32(m[g & 3], m[(g + 1) & 3]);
+				t = _mm_add_epi32(t, _mm_alignr_epi8(m[(g + 3) & 3], m[(g + 2) & 3], 4));
+				m[g & 3] = _mm_sha256msg2_epu32(t, m[(g + 3) & 3]);
+			}
+			t = _mm_add_epi32(m[g & 3], _mm_loadu_si128((const __m128i *)&K[4 * g]));
+			s1 = _mm_sha256rnds2_epu32(s1, s0, t);
+			s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(t, 0x0e));
+		}
+		s0 = _mm_add_epi32(s0, abef);
+		s1 = _mm_add_epi32(s1, cdgh);
+	}
+	t = _mm_shuffle_epi32(s0, 0x1b);
+	s1 = _mm_shuffle_epi32(s1, 0xb1);
+	_mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(t, s1, 0xf0));
+	_mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(s1, t, 8));
+}
+
+static int have_shani(void)
+{
+	unsigned a, b, c, d;
+	if (__get_cpuid_max(0, 0) < 7)
+		return 0;
+	__cpuid(1, a, b, c, d);
+	if (!(c & bit_SSE4_1))
+		return 0;
+	__cpuid_count(7, 0, a, b, c, d);
+	return !!(b & (1 << 29));
+}
+#endif
+
+static void (*blocks)(uint32_t state[8], const unsigned char *data, size_t n) = blocks_generic;
+
+/* the genesis block's header and its double sha-256, the hash shown as
+   000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f */
+static const unsigned char genesis[80] = {
+	0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x3b, 0xa3, 0xed, 0xfd, 0x7a, 0x7b, 0x12, 0xb2, 0x7a, 0xc7, 0x2c, 0x3e,
+	0x67, 0x76, 0x8f, 0x61, 0x7f, 0xc8, 0x1b, 0xc3, 0x88, 0x8a, 0x51, 0x32, 0x3a, 0x9f, 0xb8, 0xaa,
+	0x4b, 0x1e, 0x5e, 0x4a, 0x29, 0xab, 0x5f, 0x49, 0xff, 0xff, 0x00, 0x1d, 0x1d, 0xac, 0x2b, 0x7c,
+};
+static const unsigned char genesis_hash[32] = {
+	0x6f, 0xe2, 0x8c, 0x0a, 0xb6, 0xf1, 0xb3, 0x72, 0xc1, 0xa6, 0xa2, 0x46, 0xae, 0x63, 0xf7, 0x4f,
+	0x93, 0x1e, 0x83, 0x65, 0xe1, 0x5a, 0x08, 0x9c, 0x68, 0xd6, 0x19, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static int known_answer(void)
+{
+	unsigned char out[32];
+	sha256d(genesis, sizeof genesis, out);
+	return memcmp(out, genesis_hash, sizeof out) ? -1 : 0;
+}
+
+int sha256_setup(void)
+{
+	blocks = blocks_generic;
+	if (known_answer())
+		return -1;
+#if CONFIG_SHANI
+	if (have_shani())
+	{
+		blocks = blocks_shani;
+		if (known_answer())
+			blocks = blocks_generic;
+	}
+#endif
+	return 0;
+}
+
+const char *sha256_impl(void)
+{
+	return blocks == blocks_generic ? "generic" : "sha-ni";
+}
+
+void sha256(const void *in, size_t len, unsigned char out[32])
+{
+	const unsigned char *data = in;
+	uint32_t state[8];
+	unsigned char tail[128];
+	size_t full = len / 64, rest = len % 64, padded = rest < 56 ? 64 : 128;
+	int i;
+
+	memcpy(state, H0, sizeof state);
+	blocks(state, data, full);
+	memcpy(tail, data + 64 * full, rest);
+	tail[rest] = 0x80;
+	memset(tail + rest + 1, 0, padded - rest - 1);
+	for (i = 0; i < 8; i++)
+		tail[padded - 1 - i] = (unsigned long long)len * 8 >> 8 * i;
+	blocks(state, tail, padded / 64);
+	for (i = 0; i < 8; i++)
+	{
+		out[4 * i] = state[i] >> 24;
+		out[4 * i + 1] = state[i] >> 16;
+		out[4 * i + 2] = state[i] >> 8;
+		out[4 * i + 3] = state[i];
+	}
+}
+
+void sha256d(const void *data, size_t len, unsigned char out[32])
+{
+	unsigned char h[32];
+	sha256(data, len, h);
+	sha256(h, 32, out);
+}
+
+void sha256d_merkle(unsigned char root[32], const unsigned char (*branch)[32], unsigned n)
+{
+	unsigned char pair[64];
+	unsigned i;
+	for (i = 0; i < n; i++)
+	{
+		memcpy(pair, root, 32);
+		memcpy(pair + 32, branch[i], 32);
+		sha256d(pair, 64, root);
+	}
+}
+
+#endif
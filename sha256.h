@@ -0,0 +1,26 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+
+//RcB: DEP "sha256.c"
+
+/* the double sha-256 of bitcoin headers and coinbases, the merkle root
+   over a coinbase and its branch, and plain sha-256 for noise. the
+   compression function uses the x86 sha extensions when the cpu has them
+   and portable c otherwise. every share is a chain of dependent hashes,
+   so there is nothing to spread over wider vector lanes. only built with
+   the stratum code, like ec.c and noise.c. */
+
+/* picks the implementation, call once before hashing from several threads.
+   each one has to hash the genesis header right to be picked, -1 if not
+   even the portable one does. */
+int sha256_setup(void);
+/* "sha-ni" or "generic" */
+const char *sha256_impl(void);
+void sha256(const void *data, size_t len, unsigned char out[32]);
+void sha256d(const void *data, size_t len, unsigned char out[32]);
+/* root = sha256d(root || branch[i]) for each of the n branch hashes */
+void sha256d_merkle(unsigned char root[32], const unsigned char (*branch)[32], unsigned n);
+
+#endif
@@ -0,0 +1,101 @@
+#define _GNU_SOURCE
+#include "slab.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+struct freeobj
+{
+	struct freeobj *next;
+};
+
+int slab_init(struct slab *s, const char *name, size_t size, unsigned per_chunk, unsigned nshards)
+{
+	unsigned i;
+	if (!nshards || nshards > SLAB_SHARDS || !per_chunk)
+		return -1;
+	if (size < sizeof(struct freeobj))
+		size = sizeof(struct freeobj);
+	s->name = name;
+	s->size = (size + 15) & ~(size_t)15;
+	s->per_chunk = per_chunk;
+	s->nshards = nshards;
+	for (i = 0; i < nshards; i++)
+	{
+		struct slab_shard *sh = &s->shards[i];
+		pthread_mutex_init(&sh->mutex, 0);
+		sh->free = 0;
+		sh->chunks = sh->inuse = sh->peak = 0;
+	}
+	return 0;
+}
+
+static struct slab_shard *shard_of(struct slab *s, int shard)
+{
+	return &s->shards[(unsigned)shard % s->nshards];
+}
+
+/* called with the shard locked */
+static int grow(struct slab *s, struct slab_shard *sh)
+{
+	char *chunk = malloc(s->size * s->per_chunk);
+	unsigned i;
+	if (!chunk)
+		return -1;
+	for (i = 0; i < s->per_chunk; i++)
+	{
+		struct freeobj *o = (void *)(chunk + i * s->size);
+		o->next = sh->free;
+		sh->free = o;
+	}
+	sh->chunks++;
+	return 0;
+}
+
+void *slab_alloc(struct slab *s, int shard)
+{
+	struct slab_shard *sh = shard_of(s, shard);
+	struct freeobj *o = 0;
+	pthread_mutex_lock(&sh->mutex);
+	if (sh->free || !grow(s, sh))
+	{
+		o = sh->free;
+		sh->free = o->next;
+		if (++sh->inuse > sh->peak)
+			sh->peak = sh->inuse;
+	}
+	pthread_mutex_unlock(&sh->mutex);
+	return o;
+}
+
+void slab_free(struct slab *s, int shard, void *p)
+{
+	struct slab_shard *sh = shard_of(s, shard);
+	struct freeobj *o = p;
+	if (!p)
+		return;
+	pthread_mutex_lock(&sh->mutex);
+	o->next = sh->free;
+	sh->free = o;
+	/* in use is per shard, it goes negative where foreign objects end up */
+	sh->inuse--;
+	pthread_mutex_unlock(&sh->mutex);
+}
+
+void slab_dump(struct slab *s, int fd)
+{
+	long long inuse = 0;
+	unsigned long long chunks = 0, peak = 0;
+	unsigned i;
+	if (!s->nshards)
+		return;
+	for (i = 0; i < s->nshards; i++)
+	{
+		struct slab_shard *sh = &s->shards[i];
+		inuse += (long long)__atomic_load_n(&sh->inuse, __ATOMIC_RELAXED);
+		chunks += __atomic_load_n(&sh->chunks, __ATOMIC_RELAXED);
+		peak += __atomic_load_n(&sh->peak, __ATOMIC_RELAXED);
+	}
+	dprintf(fd, "slab %s: %lld in use of %llu (%zu bytes each, %lluKB), peak %llu\n",
+			s->name, inuse, chunks * s->per_chunk, s->size,
+			chunks * s->per_chunk * s->size / 1024, peak);
+}
@@ -0,0 +1,40 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+//RcB: DEP "slab.c"
+
+/* fixed size object caches. objects are carved from chunks of
+   per_chunk objects and recycled through a free list, chunks are never
+   given back. a cache is split into shards with a lock each, callers
+   pass the shard they run on (e.g. their coroutine worker), so the
+   shards' locks are practically never contended. an object may be freed
+   to another shard than the one it came from. */
+
+#define SLAB_SHARDS 65
+
+struct slab_shard
+{
+	pthread_mutex_t mutex;
+	void *free;
+	unsigned long long chunks, inuse, peak;
+} __attribute__((aligned(64)));
+
+struct slab
+{
+	const char *name;
+	size_t size;
+	unsigned per_chunk, nshards;
+	struct slab_shard shards[SLAB_SHARDS];
+};
+
+/* objects of size bytes for nshards users. returns 0 on success. */
+int slab_init(struct slab *s, const char *name, size_t size, unsigned per_chunk, unsigned nshards);
+/* shard is taken modulo the number of shards, so -1 or any id works */
+void *slab_alloc(struct slab *s, int shard);
+void slab_free(struct slab *s, int shard, void *p);
+void slab_dump(struct slab *s, int fd);
+
+#endif
@@ -0,0 +1,373 @@
+#define _GNU_SOURCE
+#include "sockmap.h"
+#include <errno.h>
+#include <stdio.h>
+
+#if CONFIG_SOCKMAP
+#include "coro.h"
+#include <linux/bpf.h>
+#include <linux/sockios.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef SO_COOKIE
+#define SO_COOKIE 57
+#endif
+
+#define INSN(c, d, s, o, i) ((struct bpf_insn){.code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i)})
+#define MOV64_REG(d, s) INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define MOV64_IMM(d, i) INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define ADD64_IMM(d, i) INSN(BPF_ALU64 | BPF_ADD | BPF_K, d, 0, 0, i)
+#define LDX_W(d, s, o) INSN(BPF_LDX | BPF_MEM | BPF_W, d, s, o, 0)
+#define STX_DW(d, s, o) INSN(BPF_STX | BPF_MEM | BPF_DW, d, s, o, 0)
+#define XADD_DW(d, s, o) INSN(BPF_STX | BPF_XADD | BPF_DW, d, s, o, 0)
+#define LD_MAP(d, fd) INSN(BPF_LD | BPF_DW | BPF_IMM, d, BPF_PSEUDO_MAP_FD, 0, fd), INSN(0, 0, 0, 0, 0)
+#define JNE_IMM(d, i, o) INSN(BPF_JMP | BPF_JNE | BPF_K, d, 0, o, i)
+#define JEQ_IMM(d, i, o) INSN(BPF_JMP | BPF_JEQ | BPF_K, d, 0, o, i)
+#define CALL(f) INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define EXIT() INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+static int peers = -1, bytes = -1;
+static unsigned long long tunnels, fallbacks, moved[2];
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof *attr);
+}
+
+static int map_create(int type, unsigned vsize, unsigned max)
+{
+	union bpf_attr a;
+	memset(&a, 0, sizeof a);
+	a.map_type = type;
+	a.key_size = sizeof(unsigned long long);
+	a.value_size = vsize;
+	a.max_entries = max;
+	return sys_bpf(BPF_MAP_CREATE, &a);
+}
+
+static int prog_load(const struct bpf_insn *insns, size_t n)
+{
+	static char log[4096];
+	union bpf_attr a;
+	int fd, err;
+	memset(&a, 0, sizeof a);
+	a.prog_type = BPF_PROG_TYPE_SK_SKB;
+	a.insns = (unsigned long)insns;
+	a.insn_cnt = n;
+	a.license = (unsigned long)"Dual MIT/GPL";
+	if ((fd = sys_bpf(BPF_PROG_LOAD, &a)) >= 0 || errno == EPERM || errno == ENOSYS)
+		return fd;
+	/* once more for the verifier's complaint */
+	err = errno;
+	a.log_buf = (unsigned long)log;
+	a.log_size = sizeof log;
+	a.log_level = 1;
+	if (sys_bpf(BPF_PROG_LOAD, &a) < 0)
+		dprintf(2, "sockmap: %s", log);
+	errno = err;
+	return -1;
+}
+
+static int prog_attach(int prog, int type)
+{
+	union bpf_attr a;
+	memset(&a, 0, sizeof a);
+	a.target_fd = peers;
+	a.attach_bpf_fd = prog;
+	a.attach_type = type;
+	return sys_bpf(BPF_PROG_ATTACH, &a);
+}
+
+static int map_update(int map, unsigned long long key, const void *value)
+{
+	union bpf_attr a;
+	memset(&a, 0, sizeof a);
+	a.map_fd = map;
+	a.key = (unsigned long)&key;
+	a.value = (unsigned long)value;
+	a.flags = BPF_ANY;
+	return sys_bpf(BPF_MAP_UPDATE_ELEM, &a);
+}
+
+static int map_lookup(int map, unsigned long long key, void *value)
+{
+	union bpf_attr a;
+	memset(&a, 0, sizeof a);
+	a.map_fd = map;
+	a.key = (unsigned long)&key;
+	a.value = (unsigned long)value;
+	return sys_bpf(BPF_MAP_LOOKUP_ELEM, &a);
+}
+
+static void map_delete(int map, unsigned long long key)
+{
+	union bpf_attr a;
+	memset(&a, 0, sizeof a);
+	a.map_fd = map;
+	a.key = (unsigned long)&key;
+	sys_bpf(BPF_MAP_DELETE_ELEM, &a);
+}
+
+int sockmap_config(unsigned max)
+{
+	int vfd = -1, pfd = -1, err;
+	if (!max || max > (1U << 30))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if ((peers = map_create(BPF_MAP_TYPE_SOCKHASH, sizeof(int), 2 * max)) < 0 ||
+		(bytes = map_create(BPF_MAP_TYPE_HASH, sizeof(unsigned long long), 2 * max)) < 0)
+		goto fail;
+	/* redirect to the socket stored under our own cookie. if there is
+	   none (yet), SK_PASS without a redirect leaves the data to us. so
+	   does an empty chunk, which only carries the fin: the kernel would
+	   fail to send it and take the peer for broken, we pass the eof on
+	   with shutdown(). */
+	struct bpf_insn verdict[] = {
+		LDX_W(BPF_REG_0, BPF_REG_1, offsetof(struct __sk_buff, len)),
+		JNE_IMM(BPF_REG_0, 0, 2),
+		MOV64_IMM(BPF_REG_0, SK_PASS),
+		EXIT(),
+		MOV64_REG(BPF_REG_6, BPF_REG_1),
+		CALL(BPF_FUNC_get_socket_cookie),
+		STX_DW(BPF_REG_10, BPF_REG_0, -8),
+		MOV64_REG(BPF_REG_1, BPF_REG_6),
+		LD_MAP(BPF_REG_2, peers),
+		MOV64_REG(BPF_REG_3, BPF_REG_10),
+		ADD64_IMM(BPF_REG_3, -8),
+		MOV64_IMM(BPF_REG_4, 0),
+		CALL(BPF_FUNC_sk_redirect_hash),
+		JNE_IMM(BPF_REG_0, SK_PASS, 8),
+		LD_MAP(BPF_REG_1, bytes),
+		MOV64_REG(BPF_REG_2, BPF_REG_10),
+		ADD64_IMM(BPF_REG_2, -8),
+		CALL(BPF_FUNC_map_lookup_elem),
+		JEQ_IMM(BPF_REG_0, 0, 2),
+		LDX_W(BPF_REG_1, BPF_REG_6, offsetof(struct __sk_buff, len)),
+		XADD_DW(BPF_REG_0, BPF_REG_1, 0),
+		MOV64_IMM(BPF_REG_0, SK_PASS),
+		EXIT(),
+	};
+	/* every chunk is a message of its own for the stream parser */
+	struct bpf_insn parser[] = {
+		LDX_W(BPF_REG_0, BPF_REG_1, offsetof(struct __sk_buff, len)),
+		EXIT(),
+	};
+	if ((vfd = prog_load(verdict, sizeof verdict / sizeof *verdict)) < 0)
+		goto fail;
+	/* a verdict without a parser needs 5.13, older kernels want both */
+	if (prog_attach(vfd, BPF_SK_SKB_VERDICT))
+	{
+		if ((pfd = prog_load(parser, sizeof parser / sizeof *parser)) < 0 ||
+			prog_attach(pfd, BPF_SK_SKB_STREAM_PARSER) ||
+			prog_attach(vfd, BPF_SK_SKB_STREAM_VERDICT))
+			goto fail;
+		close(pfd);
+	}
+	/* the maps hold on to the programs */
+	close(vfd);
+	return 0;
+fail:
+	err = errno;
+	if (pfd >= 0)
+		close(pfd);
+	if (vfd >= 0)
+		close(vfd);
+	if (bytes >= 0)
+		close(bytes);
+	if (peers >= 0)
+		close(peers);
+	peers = bytes = -1;
+	errno = err;
+	return -1;
+}
+
+int sockmap_enabled(void)
+{
+	return peers >= 0;
+}
+
+/* once the socket is in the map FIONREAD only counts what the verdict
+   passed to us, not what arrived before it, a peek sees both */
+static int pending(int fd)
+{
+	char c;
+	return recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+}
+
+static int tcp_info(int fd, struct tcp_info *ti)
+{
+	socklen_t len = sizeof *ti;
+	memset(ti, 0, sizeof *ti);
+	if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, ti, &len) ||
+		len < offsetof(struct tcp_info, tcpi_bytes_received) + sizeof ti->tcpi_bytes_received)
+		return -1;
+	return 0;
+}
+
+/* bytes the peer acknowledged, and with outq also the unacknowledged
+   ones, i.e. all that was written to fd so far */
+static int acked(int fd, unsigned long long *n, int outq)
+{
+	struct tcp_info ti;
+	int q = 0;
+	if (tcp_info(fd, &ti) || (outq && ioctl(fd, SIOCOUTQ, &q)))
+		return -1;
+	*n = ti.tcpi_bytes_acked + q;
+	return 0;
+}
+
+/* bytes that arrived on fd so far */
+static int received(int fd, unsigned long long *n)
+{
+	struct tcp_info ti;
+	if (tcp_info(fd, &ti))
+		return -1;
+	*n = ti.tcpi_bytes_received;
+	return 0;
+}
+
+int sockmap_attach(struct sockmap_pair *p, int fd1, int fd2)
+{
+	static const unsigned long long zero;
+	socklen_t len = sizeof p->cookie[0];
+	p->fd[0] = fd1;
+	p->fd[1] = fd2;
+	p->cookie[0] = p->cookie[1] = p->last = 0;
+	if (getsockopt(fd1, SOL_SOCKET, SO_COOKIE, &p->cookie[0], &len) ||
+		getsockopt(fd2, SOL_SOCKET, SO_COOKIE, &p->cookie[1], &len) ||
+		acked(fd1, &p->written[0], 1) || acked(fd2, &p->written[1], 1) ||
+		received(fd1, &p->read[0]) || received(fd2, &p->read[1]))
+		goto fallback;
+	/* all that arrived so far was read by us, if nothing is waiting */
+	if (pending(fd1) || pending(fd2))
+		goto fallback;
+	/* the counters first, the verdict looks them up on the first chunk */
+	if (map_update(bytes, p->cookie[0], &zero) || map_update(bytes, p->cookie[1], &zero) ||
+		map_update(peers, p->cookie[0], &fd2) || map_update(peers, p->cookie[1], &fd1))
+		goto undo;
+	/* data which arrived before is still queued for us. while the
+	   sockets stay in the map the kernel would redirect it along with
+	   the next chunk, but our relay loop could read it first, so let
+	   user space handle the whole tunnel instead. */
+	if (pending(fd1) || pending(fd2))
+		goto undo;
+	__atomic_add_fetch(&tunnels, 1, __ATOMIC_RELAXED);
+	return 0;
+undo:
+	sockmap_detach(p);
+fallback:
+	p->cookie[0] = p->cookie[1] = 0;
+	__atomic_add_fetch(&fallbacks, 1, __ATOMIC_RELAXED);
+	return -1;
+}
+
+static unsigned long long counted(unsigned long long cookie)
+{
+	unsigned long long n = 0;
+	map_lookup(bytes, cookie, &n);
+	return n;
+}
+
+int sockmap_progress(struct sockmap_pair *p)
+{
+	unsigned long long now = counted(p->cookie[0]) + counted(p->cookie[1]);
+	int moved = now != p->last;
+	p->last = now;
+	return moved;
+}
+
+int sockmap_flush(struct sockmap_pair *p, int fd, int timeout_ms)
+{
+	int i = fd == p->fd[1], wait = 1, idle = 0;
+	unsigned long long done, in, moved, prev = 0;
+	/* what fd received is redirected to its peer, and vice versa. the
+	   eof can be read while the verdict is still at the last chunks
+	   before it, so those have to show up in the counter first. the
+	   peer's received bytes include its fin. */
+	while (!acked(fd, &done, 0) && !received(p->fd[!i], &in) &&
+		   ((moved = counted(p->cookie[!i])) + p->read[!i] + 1 < in || done < p->written[i] + moved))
+	{
+		if (done != prev)
+		{
+			idle = 0;
+			wait = 1;
+		}
+		else if ((idle += wait) >= timeout_ms)
+			return -1;
+		prev = done;
+		coro_poll(0, 0, wait);
+		if (wait < 64)
+			wait *= 2;
+	}
+	return 0;
+}
+
+void sockmap_detach(struct sockmap_pair *p)
+{
+	int i;
+	for (i = 0; i < 2; i++)
+	{
+		if (!p->cookie[i])
+			continue;
+		map_delete(peers, p->cookie[i]);
+		__atomic_add_fetch(&moved[i], counted(p->cookie[i]), __ATOMIC_RELAXED);
+		map_delete(bytes, p->cookie[i]);
+	}
+}
+
+void sockmap_dump(int fd)
+{
+	if (peers < 0)
+		return;
+	dprintf(fd, "sockmap: %llu tunnels in the kernel, %llu relayed in user space, "
+				"bytes up %llu down %llu\n",
+			__atomic_load_n(&tunnels, __ATOMIC_RELAXED), __atomic_load_n(&fallbacks, __ATOMIC_RELAXED),
+			__atomic_load_n(&moved[0], __ATOMIC_RELAXED), __atomic_load_n(&moved[1], __ATOMIC_RELAXED));
+}
+
+#else
+
+int sockmap_config(unsigned max)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int sockmap_enabled(void)
+{
+	return 0;
+}
+
+int sockmap_attach(struct sockmap_pair *p, int fd1, int fd2)
+{
+	return -1;
+}
+
+int sockmap_progress(struct sockmap_pair *p)
+{
+	return 0;
+}
+
+int sockmap_flush(struct sockmap_pair *p, int fd, int timeout_ms)
+{
+	return 0;
+}
+
+void sockmap_detach(struct sockmap_pair *p)
+{
+}
+
+void sockmap_dump(int fd)
+{
+}
+
+#endif
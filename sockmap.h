@@ -0,0 +1,47 @@
+#ifndef SOCKMAP_H
+#define SOCKMAP_H
+
+//RcB: DEP "sockmap.c"
+
+/* kernel side relay of plain tunnels. both sockets of an established
+   tunnel go into a bpf sockhash, keyed by the socket cookie of their
+   peer, and an sk_skb verdict program redirects every chunk a socket
+   receives to the one stored under its own cookie. the data never
+   reaches user space, the relay loop only wakes for eof, errors and the
+   idle timeout. the program counts the redirected bytes per socket in a
+   second map.
+   the programs are assembled here and loaded with the raw bpf() syscall,
+   without libbpf. where that fails, e.g. no CAP_BPF or an old kernel,
+   tunnels are relayed in user space as before. */
+
+#ifndef CONFIG_SOCKMAP
+#define CONFIG_SOCKMAP 1
+#endif
+
+struct sockmap_pair
+{
+	int fd[2];
+	unsigned long long cookie[2], last;
+	/* bytes written to the socket by us, and read from it by us, also
+	   before it went into the map */
+	unsigned long long written[2], read[2];
+};
+
+/* load the programs for up to max tunnels. returns 0 on success,
+   -1 with errno set otherwise. */
+int sockmap_config(unsigned max);
+int sockmap_enabled(void);
+/* hand the tunnel between fd1 and fd2 to the kernel. returns -1 if it
+   has to be relayed in user space, e.g. because data arrived before the
+   sockets were in the map. */
+int sockmap_attach(struct sockmap_pair *p, int fd1, int fd2);
+/* nonzero if data moved since the last call */
+int sockmap_progress(struct sockmap_pair *p);
+/* wait until the peer of fd has acknowledged all data the kernel
+   redirected to fd, which has to happen before fd is shut down. gives
+   up after timeout_ms without progress and returns -1. */
+int sockmap_flush(struct sockmap_pair *p, int fd, int timeout_ms);
+void sockmap_detach(struct sockmap_pair *p);
+void sockmap_dump(int fd);
+
+#endif
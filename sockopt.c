@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+#include "sockopt.h"
+#include "sblist.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+enum sockopt_flag
+{
+	SOF_NODELAY = 1 << 0,
+	SOF_QUICKACK = 1 << 1,
+	SOF_KEEPALIVE = 1 << 2,
+	SOF_RCVBUF = 1 << 3,
+	SOF_SNDBUF = 1 << 4,
+	SOF_LOWAT = 1 << 5,
+	SOF_CC = 1 << 6,
+};
+
+struct profile
+{
+	enum sockside side;
+	int port;
+	unsigned set;
+	int nodelay, quickack, keepalive;
+	int ka_idle, ka_intvl, ka_cnt;
+	int rcvbuf, sndbuf, lowat;
+	char cc[16];
+};
+
+static sblist *profiles;
+
+static int parse_flag(const char *value)
+{
+	return value ? atoi(value) != 0 : 1;
+}
+
+int sockopt_config(char *arg)
+{
+	char *const keys[] = {"nodelay", "quickack", "keepalive", "rcvbuf", "sndbuf", "lowat", "cc", 0};
+	struct profile p = {.port = SOCKOPT_ANY};
+	char *opts = strchr(arg, ':'), *value, *end;
+	if (!opts)
+		return -1;
+	*opts++ = 0;
+	char *port = strchr(arg, '/');
+	if (port)
+	{
+		*port++ = 0;
+		p.port = atoi(port);
+	}
+	if (!strcmp(arg, "client"))
+		p.side = SIDE_CLIENT;
+	else if (!strcmp(arg, "upstream"))
+		p.side = SIDE_UPSTREAM;
+	else
+		return -1;
+	while (*opts)
+	{
+		int i = getsubopt(&opts, keys, &value);
+		if (i < 0)
+			return -1;
+		p.set |= 1 << i;
+		switch (1 << i)
+		{
+		case SOF_NODELAY:
+			p.nodelay = parse_flag(value);
+			break;
+		case SOF_QUICKACK:
+			p.quickack = parse_flag(value);
+			break;
+		case SOF_KEEPALIVE:
+			p.keepalive = 1;
+			if (value && !strchr(value, ':'))
+				p.keepalive = parse_flag(value);
+			else if (value && sscanf(value, "%d:%d:%d", &p.ka_idle, &p.ka_intvl, &p.ka_cnt) != 3)
+				return -1;
+			break;
+		case SOF_RCVBUF:
+		case SOF_SNDBUF:
+		case SOF_LOWAT:
+			if (!value)
+				return -1;
+			*(i == 3 ? &p.rcvbuf : i == 4 ? &p.sndbuf : &p.lowat) = parse_size(value, &end);
+			if (*end)
+				return -1;
+			break;
+		case SOF_CC:
+			if (!value || strlen(value) >= sizeof p.cc)
+				return -1;
+			strcpy(p.cc, value);
+			break;
+		}
+	}
+	if (!profiles && !(profiles = sblist_new(sizeof p, 4)))
+		return -1;
+	return sblist_add(profiles, &p) ? 0 : -1;
+}
+
+static void apply(int fd, const struct profile *p)
+{
+	if (p->set & SOF_NODELAY)
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &p->nodelay, sizeof(int));
+#ifdef TCP_QUICKACK
+	/* not sticky in linux, the stack may fall back to delayed acks later */
+	if (p->set & SOF_QUICKACK)
+		setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &p->quickack, sizeof(int));
+#endif
+	if (p->set & SOF_KEEPALIVE)
+	{
+		setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &p->keepalive, sizeof(int));
+#ifdef TCP_KEEPIDLE
+		if (p->keepalive && p->ka_idle)
+		{
+			setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &p->ka_idle, sizeof(int));
+			setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &p->ka_intvl, sizeof(int));
+			setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &p->ka_cnt, sizeof(int));
+		}
+#endif
+	}
+	if (p->set & SOF_RCVBUF)
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &p->rcvbuf, sizeof(int));
+	if (p->set & SOF_SNDBUF)
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &p->sndbuf, sizeof(int));
+#ifdef TCP_NOTSENT_LOWAT
+	if (p->set & SOF_LOWAT)
+		setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &p->lowat, sizeof(int));
+#endif
+#ifdef TCP_CONGESTION
+	if (p->set & SOF_CC)
+		setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, p->cc, strlen(p->cc));
+#endif
+}
+
+void sockopt_apply(int fd, enum sockside side, int port)
+{
+	struct profile *p;
+	if (!profiles)
+		return;
+	sblist_iter(profiles, p)
+	{
+		if (p->side == side && p->port == port)
+			apply(fd, p);
+	}
+}
+
+void sockopt_listener(int fd)
+{
+	struct profile *p;
+	if (!profiles)
+		return;
+	sblist_iter(profiles, p)
+	{
+		if (p->side != SIDE_CLIENT || p->port != SOCKOPT_ANY)
+			continue;
+		if (p->set & SOF_RCVBUF)
+			setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &p->rcvbuf, sizeof(int));
+		if (p->set & SOF_SNDBUF)
+			setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &p->sndbuf, sizeof(int));
+	}
+}
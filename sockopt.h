@@ -0,0 +1,29 @@
+#ifndef SOCKOPT_H
+#define SOCKOPT_H
+
+//RcB: DEP "sockopt.c"
+
+/* user configurable socket options, kept as profiles per side of the
+   tunnel and optionally per destination port. */
+
+enum sockside
+{
+	SIDE_CLIENT,
+	SIDE_UPSTREAM,
+};
+
+/* matches the profiles that were given without a destination port */
+#define SOCKOPT_ANY -1
+
+/* parse "side[/port]:opt,opt=value,...", where side is client or upstream
+   and the options are nodelay, quickack, keepalive[=idle:intvl:cnt],
+   rcvbuf=N, sndbuf=N, lowat=N and cc=name. returns 0 on success. */
+int sockopt_config(char *arg);
+/* apply the profiles of side for port, or the generic ones for SOCKOPT_ANY */
+void sockopt_apply(int fd, enum sockside side, int port);
+/* the buffer sizes of the generic client profiles, for the listening socket
+   to hand down to accepted connections before their handshake sizes the
+   receive window. */
+void sockopt_listener(int fd);
+
+#endif
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include "srcpool.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+struct srcaddr
+{
+	union sockaddr_union addr;
+	socklen_t len;
+	unsigned active;
+	unsigned long long total, failed, exhausted;
+};
+
+static struct srcaddr pool[SRCPOOL_MAX];
+static unsigned npool;
+/* indices into pool per family, [0] is v4 and [1] is v6 */
+static unsigned byfamily[2][SRCPOOL_MAX], nfamily[2];
+static unsigned rr_next[2];
+static int round_robin;
+
+int srcpool_config(char *list)
+{
+	char *tok, *save;
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(0, ",", &save))
+	{
+		struct srcaddr *s = &pool[npool];
+		if (!strcmp(tok, "rr") || !strcmp(tok, "hash"))
+		{
+			round_robin = tok[0] == 'r';
+			continue;
+		}
+		if (npool == SRCPOOL_MAX)
+			return -1;
+		if (inet_pton(AF_INET, tok, &s->addr.v4.sin_addr) == 1)
+		{
+			s->addr.v4.sin_family = AF_INET;
+			s->len = sizeof s->addr.v4;
+		}
+		else if (inet_pton(AF_INET6, tok, &s->addr.v6.sin6_addr) == 1)
+		{
+			s->addr.v6.sin6_family = AF_INET6;
+			s->len = sizeof s->addr.v6;
+		}
+		else
+			return -1;
+		int f = s->len != sizeof s->addr.v4;
+		byfamily[f][nfamily[f]++] = npool++;
+	}
+	return npool ? 0 : -1;
+}
+
+int srcpool_enabled(void)
+{
+	return npool != 0;
+}
+
+static unsigned client_hash(const union sockaddr_union *client)
+{
+	size_t len;
+	const unsigned char *ip = sockaddr_ip(client, &len);
+	unsigned h = 2166136261u;
+	while (len--)
+		h = (h ^ *ip++) * 16777619u;
+	return h;
+}
+
+int srcpool_bind(int fd, int family, const union sockaddr_union *client, struct srcaddr **src)
+{
+	int f = family == AF_INET6, one = 1;
+	unsigned i;
+	*src = 0;
+	if (!nfamily[f])
+		return 0;
+	if (round_robin)
+		i = __atomic_fetch_add(&rr_next[f], 1, __ATOMIC_RELAXED);
+	else
+		i = client_hash(client);
+	struct srcaddr *s = &pool[byfamily[f][i % nfamily[f]]];
+#ifdef IP_BIND_ADDRESS_NO_PORT
+	/* otherwise bind() reserves a port for any destination, which
+	   exhausts the ports of the address at the same rate as before. */
+	setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof one);
+#endif
+	if (bind(fd, (struct sockaddr *)&s->addr, s->len) == -1)
+	{
+		__atomic_add_fetch(&s->failed, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	__atomic_add_fetch(&s->active, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&s->total, 1, __ATOMIC_RELAXED);
+	*src = s;
+	return 0;
+}
+
+void srcpool_failed(struct srcaddr *src, int err)
+{
+	if (!src)
+		return;
+	/* connect() couldn't find a free port for this destination */
+	if (err == EADDRNOTAVAIL)
+		__atomic_add_fetch(&src->exhausted, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&src->failed, 1, __ATOMIC_RELAXED);
+	srcpool_release(src);
+}
+
+void srcpool_release(struct srcaddr *src)
+{
+	if (src)
+		__atomic_sub_fetch(&src->active, 1, __ATOMIC_RELAXED);
+}
+
+void srcpool_dump(int fd)
+{
+	char name[INET6_ADDRSTRLEN];
+	size_t len;
+	unsigned i;
+	for (i = 0; i < npool; i++)
+	{
+		struct srcaddr *s = &pool[i];
+		inet_ntop(s->addr.v4.sin_family, sockaddr_ip(&s->addr, &len), name, sizeof name);
+		dprintf(fd, "source %s: active %u total %llu failed %llu port exhaustion %llu\n", name,
+				__atomic_load_n(&s->active, __ATOMIC_RELAXED),
+				__atomic_load_n(&s->total, __ATOMIC_RELAXED),
+				__atomic_load_n(&s->failed, __ATOMIC_RELAXED),
+				__atomic_load_n(&s->exhausted, __ATOMIC_RELAXED));
+	}
+}
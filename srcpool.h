@@ -0,0 +1,33 @@
+#ifndef SRCPOOL_H
+#define SRCPOOL_H
+
+#include "server.h"
+
+//RcB: DEP "srcpool.c"
+
+/* pool of local source addresses for outgoing connections. every source
+   address has its own range of ephemeral ports per destination, so
+   spreading tunnels over N addresses allows N times as many concurrent
+   connections to a single destination. sockets are bound with
+   IP_BIND_ADDRESS_NO_PORT, which leaves picking the port to connect(). */
+
+#define SRCPOOL_MAX 64
+
+struct srcaddr;
+
+/* parse a comma separated list of v4/v6 addresses, optionally containing
+   "rr" (round-robin) or "hash" (by client ip, the default) to select how
+   addresses are picked. returns 0 on success. */
+int srcpool_config(char *list);
+int srcpool_enabled(void);
+/* bind fd of the given family to an address from the pool. *src is set to
+   the address used, or NULL if the pool has none of that family.
+   returns 0 on success. */
+int srcpool_bind(int fd, int family, const union sockaddr_union *client, struct srcaddr **src);
+/* the connect on src failed with errno err, this releases src too */
+void srcpool_failed(struct srcaddr *src, int err);
+/* the tunnel using src is closed, src may be NULL */
+void srcpool_release(struct srcaddr *src);
+void srcpool_dump(int fd);
+
+#endif
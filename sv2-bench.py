@@ -0,0 +1,370 @@
+#!/usr/bin/env python3
+# bandwidth and latency of the stratum v1 to v2 translation (-V), against a
+# mock v2 pool this script runs itself, e.g.
+#   ./microsocks -p 1080 -V pool.example:3333=127.0.0.1:3336,user=bench &
+#   ./sv2-bench.py 1080 3336 500
+# a v1 miner connects through the proxy to pool.example:3333 and, like cpuminer
+# or cgminer, waits for the result of mining.subscribe before it authorizes;
+# pipelined adds a second miner that sends both at once. the pool sends
+# the given number of jobs (12 merkle branches, 200 bytes of coinbase), one
+# every 20 ms, and the miner submits a share for each, every other one is
+# rejected. reported are the bytes on both legs, the time from a job leaving
+# the pool until its mining.notify arrives, and the round trip of mining.submit
+# including the pool. ./sv2-bench.py pool 3336 only runs the pool, for trying
+# a miner by hand. the pool speaks noise or, to a proxy configured with plain,
+# the plaintext transport. its certificate is signed by a fixed authority,
+#   key=9cATPccqbNWLUmEyHgrd9Xxs9tfzT5ncyEdgXXj24Ne6B1Q596c
+# checks it. the noise side is plain python, so the pool adds its own
+# milliseconds to the latencies there.
+import hashlib, hmac, json, os, socket, struct, sys, threading, time
+
+BRANCHES, INTERVAL = 12, 0.02
+SETUP, SETUP_OK, OPEN_EXT, OPEN_EXT_OK = 0x00, 0x01, 0x13, 0x14
+SUBMIT, SUBMIT_OK, SUBMIT_ERR, JOB, PREVHASH = 0x1b, 0x1c, 0x1d, 0x1f, 0x20
+CHANNEL = 7
+# the payload of a noise message, 65535 bytes with the mac
+CHUNK = 65519
+
+# secp256k1, ellswift keys (BIP 324) and BIP 340 signatures
+P = 2**256 - 2**32 - 977
+N = 0xfffffffffffffffffffffffffffffffebaaedce6af48a03bbfd25e8cd0364141
+G = (0x79be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798,
+	0x483ada7726a3c4655da4fbfc0e1108a8fd17b448a68554199c47d08ffb10d4b8)
+AUTHORITY = int.from_bytes(hashlib.sha256(b'sv2-bench authority').digest(), 'big') % N
+
+def inv(a):
+	return pow(a, P - 2, P)
+
+def sqrt(a):
+	v = pow(a, (P + 1) // 4, P)
+	return v if v * v % P == a % P else None
+
+C = sqrt(P - 3)
+
+def on_curve(x):
+	return sqrt((x**3 + 7) % P) is not None
+
+def add(a, b):
+	if not a or not b:
+		return a or b
+	if a[0] == b[0] and (a[1] + b[1]) % P == 0:
+		return None
+	if a == b:
+		l = 3 * a[0] * a[0] * inv(2 * a[1]) % P
+	else:
+		l = (b[1] - a[1]) * inv(b[0] - a[0]) % P
+	x = (l * l - a[0] - b[0]) % P
+	return (x, (l * (a[0] - x) - a[1]) % P)
+
+def mul(k, p):
+	r = None
+	while k:
+		if k & 1:
+			r = add(r, p)
+		p, k = add(p, p), k >> 1
+	return r
+
+def b32(x):
+	return x.to_bytes(32, 'big')
+
+def tagged(tag, m):
+	t = hashlib.sha256(tag).digest()
+	return hashlib.sha256(t + t + m).digest()
+
+def xswiftec(u, t):
+	u, t = u % P or 1, t % P or 1
+	if (u**3 + t * t + 7) % P == 0:
+		t = 2 * t % P
+	X = (u**3 + 7 - t * t) * inv(2 * t) % P
+	Y = (X + t) * inv(C * u) % P
+	for x in (u + 4 * Y * Y, (-X * inv(Y) - u) * inv(2), (X * inv(Y) - u) * inv(2)):
+		if on_curve(x % P):
+			return x % P
+
+def ellswift(k):
+	x = mul(k, G)[0]
+	while True:
+		u, case = int.from_bytes(os.urandom(32), 'big') % P, os.urandom(1)[0]
+		g = (u**3 + 7) % P
+		if case & 1:
+			y = sqrt(x - u)
+			r = y and sqrt(-3 * (u * y * inv(2))**2 - g)
+			t = y and r and (C * u * y * inv(2) + r) % P
+		elif u and not on_curve(-x - u):
+			q = 2 * x + u
+			t = (C * u + q) % P and sqrt(g * (C * u - q) * inv(C * u + q))
+		else:
+			t = None
+		if t and xswiftec(u, t) == x:
+			return b32(u) + b32(t)
+
+def xdh(a, b, k, initiator):
+	ell = b if initiator else a
+	x = xswiftec(int.from_bytes(ell[:32], 'big'), int.from_bytes(ell[32:], 'big'))
+	y = sqrt(x**3 + 7)
+	return tagged(b'bip324_ellswift_xonly_ecdh', a + b + b32(mul(k, (x, y))[0]))
+
+def sign(d, m):
+	p = mul(d, G)
+	d = d if p[1] % 2 == 0 else N - d
+	k = int.from_bytes(tagged(b'BIP0340/nonce', b32(d ^ int.from_bytes(os.urandom(32), 'big')) + b32(p[0]) + m), 'big') % N
+	r = mul(k, G)
+	k = k if r[1] % 2 == 0 else N - k
+	e = int.from_bytes(tagged(b'BIP0340/challenge', b32(r[0]) + b32(p[0]) + m), 'big') % N
+	return b32(r[0]) + b32((k + e * d) % N)
+
+# ChaCha20-Poly1305 with the noise nonce
+def chacha(key, counter, nonce):
+	x = [0x61707865, 0x3320646e, 0x79622d32, 0x6b206574] + list(struct.unpack('<8I', key)) + [counter] + list(struct.unpack('<3I', nonce))
+	s = list(x)
+	def qr(a, b, c, d):
+		for r1, r2 in ((16, 12), (8, 7)):
+			s[a] = (s[a] + s[b]) & 0xffffffff
+			s[d] ^= s[a]
+			s[d] = (s[d] << r1 | s[d] >> (32 - r1)) & 0xffffffff
+			s[c] = (s[c] + s[d]) & 0xffffffff
+			s[b] ^= s[c]
+			s[b] = (s[b] << r2 | s[b] >> (32 - r2)) & 0xffffffff
+	for i in range(10):
+		qr(0, 4, 8, 12), qr(1, 5, 9, 13), qr(2, 6, 10, 14), qr(3, 7, 11, 15)
+		qr(0, 5, 10, 15), qr(1, 6, 11, 12), qr(2, 7, 8, 13), qr(3, 4, 9, 14)
+	return struct.pack('<16I', *((a + b) & 0xffffffff for a, b in zip(s, x)))
+
+def xor(key, nonce, data):
+	stream = b''.join(chacha(key, 1 + i, nonce) for i in range((len(data) + 63) // 64))
+	return bytes(a ^ b for a, b in zip(data, stream))
+
+def poly(key, ad, ct):
+	pad = lambda b: b + bytes(-len(b) % 16)
+	m = pad(ad) + pad(ct) + struct.pack('<QQ', len(ad), len(ct))
+	r = int.from_bytes(key[:16], 'little') & 0x0ffffffc0ffffffc0ffffffc0fffffff
+	acc = 0
+	for i in range(0, len(m), 16):
+		acc = (acc + int.from_bytes(m[i:i + 16] + b'\1', 'little')) * r % (2**130 - 5)
+	return ((acc + int.from_bytes(key[16:], 'little')) % 2**128).to_bytes(16, 'little')
+
+class Cipher:
+	def __init__(self, k):
+		self.k, self.n = k, 0
+
+	def seal(self, data, ad=b''):
+		nonce = struct.pack('<IQ', 0, self.n)
+		self.n += 1
+		ct = xor(self.k, nonce, data)
+		return ct + poly(chacha(self.k, 0, nonce)[:32], ad, ct)
+
+	def open(self, data, ad=b''):
+		nonce = struct.pack('<IQ', 0, self.n)
+		self.n += 1
+		if poly(chacha(self.k, 0, nonce)[:32], ad, data[:-16]) != data[-16:]:
+			raise EOFError
+		return xor(self.k, nonce, data[:-16])
+
+def hkdf(ck, ikm):
+	t = hmac.new(ck, ikm, 'sha256').digest()
+	a = hmac.new(t, b'\1', 'sha256').digest()
+	return a, hmac.new(t, a + b'\2', 'sha256').digest()
+
+class Noise:
+	"""the responder of Noise_NX_Secp256k1+EllSwift_ChaChaPoly_SHA256"""
+	def __init__(self, c, hello):
+		h = hashlib.sha256(b'Noise_NX_Secp256k1+EllSwift_ChaChaPoly_SHA256').digest()
+		ck = h
+		for m in (b'', hello, b''):
+			h = hashlib.sha256(h + m).digest()
+		e, s = [int.from_bytes(os.urandom(32), 'big') % (N - 1) + 1 for i in range(2)]
+		ee, se = ellswift(e), ellswift(s)
+		h = hashlib.sha256(h + ee).digest()
+		ck, k = hkdf(ck, xdh(hello, ee, e, False))
+		es = Cipher(k).seal(se, h)
+		h = hashlib.sha256(h + es).digest()
+		ck, k = hkdf(ck, xdh(hello, se, s, False))
+		now = int(time.time())
+		cert = struct.pack('<HII', 0, now - 3600, now + 3600)
+		cert += sign(AUTHORITY, hashlib.sha256(cert + b32(mul(s, G)[0])).digest())
+		cert = Cipher(k).seal(cert, h)
+		c.sendall(ee + es + cert)
+		rx, tx = hkdf(ck, b'')
+		self.rx, self.tx = Cipher(rx), Cipher(tx)
+
+	def seal(self, f):
+		p = f[6:]
+		return self.tx.seal(f[:6]) + b''.join(self.tx.seal(p[i:i + CHUNK]) for i in range(0, len(p), CHUNK))
+
+	def read(self, c):
+		h = self.rx.open(readn(c, 22))
+		n, p = int.from_bytes(h[3:6], 'little'), b''
+		while len(p) < n:
+			p += self.rx.open(readn(c, min(n - len(p), CHUNK) + 16))
+		return h, p
+
+def frame(ext, t, p):
+	return struct.pack('<HB', ext, t) + struct.pack('<I', len(p))[:3] + p
+
+def str0(b):
+	return bytes([len(b)]) + b
+
+def readn(c, n):
+	b = b''
+	while len(b) < n:
+		x = c.recv(n - len(b))
+		if not x:
+			raise EOFError
+		b += x
+	return b
+
+def job(jid, future):
+	branches = bytes([BRANCHES]) + b''.join(bytes([i]) * 32 for i in range(BRANCHES))
+	prefix, suffix = b'\1' * 120, b'\2' * 80
+	return frame(0x8000, JOB, struct.pack('<II', CHANNEL, jid) +
+		(b'\0' if future else b'\1' + struct.pack('<I', 1700000000)) +
+		struct.pack('<IB', 0x20000000, 1) + branches +
+		struct.pack('<H', len(prefix)) + prefix + struct.pack('<H', len(suffix)) + suffix)
+
+class Link:
+	"""a connection from the proxy, in noise unless it starts with SetupConnection"""
+	def __init__(self, c):
+		self.c, self.lock, self.noise, self.head = c, threading.Lock(), None, readn(c, 6)
+		if self.head[:3] != b'\0\0\0':
+			self.noise, self.head = Noise(c, self.head + readn(c, 58)), None
+
+	def read(self):
+		if self.noise:
+			return self.noise.read(self.c)
+		h, self.head = self.head or readn(self.c, 6), None
+		return h, readn(self.c, int.from_bytes(h[3:6], 'little'))
+
+class Pool:
+	def __init__(self, port, jobs):
+		self.jobs, self.sent, self.bytes, self.transport = jobs, {}, 0, None
+		self.ls = socket.socket()
+		self.ls.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+		self.ls.bind(('127.0.0.1', port))
+		self.ls.listen(8)
+
+	def run(self):
+		while True:
+			c, _ = self.ls.accept()
+			c.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+			threading.Thread(target=self.session, args=(c,), daemon=True).start()
+
+	def send(self, l, f, jid=None):
+		with l.lock:
+			if l.noise:
+				f = l.noise.seal(f)
+			if jid:
+				self.sent[jid] = time.monotonic()
+			l.c.sendall(f)
+			self.bytes += len(f)
+
+	def feed(self, l):
+		for i in range(self.jobs):
+			time.sleep(INTERVAL)
+			self.send(l, job(2 + i, False), 2 + i)
+
+	def session(self, c):
+		try:
+			l = Link(c)
+			self.transport = 'noise' if l.noise else 'plaintext'
+			while True:
+				h, p = l.read()
+				t = h[2]
+				if t == SETUP:
+					self.send(l, frame(0, SETUP_OK, struct.pack('<HI', 2, 0)))
+				elif t == OPEN_EXT:
+					rid = struct.unpack('<I', p[:4])[0]
+					target = (0xffff << 198).to_bytes(32, 'little')
+					self.send(l, frame(0, OPEN_EXT_OK, struct.pack('<II', rid, CHANNEL) + target +
+						struct.pack('<H', 4) + str0(bytes.fromhex('deadbeef'))))
+					self.send(l, job(1, True))
+					self.send(l, frame(0x8000, PREVHASH, struct.pack('<II', CHANNEL, 1) +
+						bytes(range(32)) + struct.pack('<II', 1700000000, 0x1703a30c)))
+					threading.Thread(target=self.feed, args=(l,), daemon=True).start()
+				elif t == SUBMIT:
+					ch, seq, jid, nonce = struct.unpack('<IIII', p[:16])
+					if nonce & 1:
+						self.send(l, frame(0x8000, SUBMIT_ERR, struct.pack('<II', ch, seq) + str0(b'difficulty-too-low')))
+					else:
+						self.send(l, frame(0x8000, SUBMIT_OK, struct.pack('<IIIQ', ch, seq, 1, 1024)))
+		except (EOFError, OSError):
+			pass
+		c.close()
+
+def percentile(v, p):
+	v = sorted(v)
+	return v[min(len(v) - 1, int(len(v) * p))] * 1000 if v else 0
+
+def miner(proxy, pool, pipelined):
+	s = socket.create_connection(('127.0.0.1', proxy))
+	s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+	s.sendall(b'\5\1\0')
+	readn(s, 2)
+	host = b'pool.example'
+	s.sendall(b'\5\1\0\3' + str0(host) + struct.pack('>H', 3333))
+	if readn(s, 10)[1] != 0:
+		sys.exit('the proxy refused the tunnel')
+	f = s.makefile('rb')
+	pool.bytes = 0
+	s.settimeout(10)
+	t = time.monotonic()
+	subscribe = b'{"id":1,"method":"mining.subscribe","params":["bench/1"]}\n'
+	authorize = b'{"id":2,"method":"mining.authorize","params":["bench.rig","x"]}\n'
+	received = 0
+	try:
+		s.sendall(subscribe + authorize if pipelined else subscribe)
+		while True:
+			l = f.readline()
+			received += len(l)
+			if not l or json.loads(l).get('id') == 1:
+				break
+		if not l:
+			raise EOFError
+		if not pipelined:
+			s.sendall(authorize)
+	except (EOFError, OSError, ValueError):
+		sys.exit('no answer to mining.subscribe')
+	print('%s handshake: subscribe answered after %.2f ms, %s pool' %
+		('pipelined' if pipelined else 'sequential', (time.monotonic() - t) * 1000, pool.transport))
+	s.settimeout(None)
+	notified, submitted, rtt, answers = [], {}, [], [0, 0]
+	nextid = 100
+	while len(notified) < pool.jobs or len(rtt) < pool.jobs:
+		l = f.readline()
+		if not l:
+			sys.exit('the proxy closed the tunnel')
+		now = time.monotonic()
+		received += len(l)
+		m = json.loads(l)
+		if m.get('method') == 'mining.notify':
+			jid = int(m['params'][0], 16)
+			if jid not in pool.sent:
+				continue
+			notified.append(now - pool.sent[jid])
+			submitted[nextid] = time.monotonic()
+			s.sendall(('{"id":%d,"method":"mining.submit","params":["bench.rig","%x","%08x","6553f100","%08x"]}\n' %
+				(nextid, jid, jid, nextid)).encode())
+			nextid += 1
+		elif m.get('id') in submitted:
+			rtt.append(now - submitted.pop(m['id']))
+			answers[m['result'] is True] += 1
+	s.close()
+	pool.sent.clear()
+	print('jobs %d, shares accepted %d rejected %d' % (len(notified), answers[1], answers[0]))
+	print('bytes v2 pool %d, v1 miner %d, %.2fx' % (pool.bytes, received, received / pool.bytes))
+	print('job to notify ms: median %.2f p99 %.2f max %.2f' %
+		(percentile(notified, .5), percentile(notified, .99), max(notified) * 1000))
+	print('submit round trip ms: median %.2f p99 %.2f max %.2f' %
+		(percentile(rtt, .5), percentile(rtt, .99), max(rtt) * 1000))
+
+def main():
+	if len(sys.argv) < 3:
+		sys.exit('usage: %s proxyport poolport [jobs]\n       %s pool poolport [jobs]' % (sys.argv[0], sys.argv[0]))
+	jobs = int(sys.argv[3]) if len(sys.argv) > 3 else 200
+	pool = Pool(int(sys.argv[2]), jobs)
+	if sys.argv[1] == 'pool':
+		pool.run()
+	threading.Thread(target=pool.run, daemon=True).start()
+	for pipelined in (0, 1):
+		miner(int(sys.argv[1]), pool, pipelined)
+
+main()
@@ -0,0 +1,1076 @@
+#define _GNU_SOURCE
+#include "sv2.h"
+#include <errno.h>
+
+#if CONFIG_STRATUM
+#include "coro.h"
+#include "noise.h"
+#include "server.h"
+#include "sha256.h"
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/tcp.h>
+
+/* message types of the mining protocol */
+#define SETUP_CONNECTION 0x00
+#define SETUP_CONNECTION_SUCCESS 0x01
+#define SETUP_CONNECTION_ERROR 0x02
+#define OPEN_CHANNEL_ERROR 0x12
+#define OPEN_EXTENDED_CHANNEL 0x13
+#define OPEN_EXTENDED_CHANNEL_SUCCESS 0x14
+#define SET_EXTRANONCE_PREFIX 0x19
+#define SUBMIT_SHARES_EXTENDED 0x1b
+#define SUBMIT_SHARES_SUCCESS 0x1c
+#define SUBMIT_SHARES_ERROR 0x1d
+#define NEW_EXTENDED_JOB 0x1f
+#define SET_NEW_PREV_HASH 0x20
+#define SET_TARGET 0x21
+#define CHANNEL_MSG 0x8000
+
+#define HEADER 6
+#define LINE 4096
+#define JOBS 8
+#define PENDING 64
+#define ID_LEN 32
+
+struct sv2_map
+{
+	char host[256];
+	unsigned short port;
+	char pool[256];
+	unsigned short poolport;
+	union sockaddr_union addr;
+	socklen_t addrlen;
+	char user[256];
+	int plain, have_key;
+	/* the x-only authority key of the pool's certificate */
+	unsigned char key[32];
+};
+
+struct job
+{
+	unsigned id, version, min_ntime;
+	int used, future;
+	/* "coinb1","coinb2",[branches] of the v1 notify */
+	char *v1;
+	size_t cap;
+};
+
+struct session
+{
+	struct sv2_map *map;
+	int miner, pool;
+	/* v1 side */
+	char line[LINE];
+	size_t linelen;
+	int skip;
+	char sub_id[ID_LEN], auth_id[ID_LEN];
+	int subscribed;
+	char *out;
+	size_t outlen, outcap;
+	/* v2 side, noise is 0 on the plaintext transport */
+	struct noise *noise;
+	unsigned char *frame;
+	size_t framelen, framecap;
+	int setup, opened, open;
+	unsigned channel, seq;
+	unsigned char extranonce[32];
+	unsigned extranonce_len, extranonce_size;
+	double diff;
+	struct job jobs[JOBS];
+	unsigned nextjob;
+	int have_prev;
+	unsigned char prev[32];
+	unsigned prev_job, nbits, ntime;
+	struct
+	{
+		int used;
+		unsigned seq;
+		char id[ID_LEN];
+	} pending[PENDING];
+};
+
+static struct sv2_map maps[SV2_MAX];
+static unsigned nmaps;
+static unsigned long long sessions, jobs, accepted, rejected, pool_bytes, miner_bytes;
+
+static int split_hostport(char *s, char **host, unsigned short *port)
+{
+	char *p;
+	if (*s == '[')
+	{
+		if (!(p = strchr(++s, ']')))
+			return -1;
+		*p++ = 0;
+	}
+	else
+		p = strrchr(s, ':');
+	if (!p || *p != ':' || !atoi(p + 1))
+		return -1;
+	*p = 0;
+	*host = s;
+	*port = atoi(p + 1);
+	return 0;
+}
+
+/* the authority key as pools publish it, base58check of a 2 byte version
+   (1, little endian) and the x-only key, or as 64 hex digits */
+static int parse_key(const char *s, unsigned char key[32])
+{
+	static const char alphabet[] = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+	unsigned char b[38] = {0}, sum[32];
+	const char *c;
+	unsigned v;
+	int i;
+	if (strlen(s) == 64)
+	{
+		for (i = 0; i < 32; i++)
+		{
+			if (sscanf(s + 2 * i, "%2x", &v) != 1)
+				return -1;
+			key[i] = v;
+		}
+		return 0;
+	}
+	for (; *s; s++)
+	{
+		if (!(c = strchr(alphabet, *s)))
+			return -1;
+		for (v = c - alphabet, i = sizeof b - 1; i >= 0; i--, v >>= 8)
+			b[i] = v += b[i] * 58;
+		if (v)
+			return -1;
+	}
+	sha256d(b, 34, sum);
+	if (b[0] != 1 || b[1] || memcmp(sum, b + 34, 4))
+		return -1;
+	memcpy(key, b + 2, 32);
+	return 0;
+}
+
+int sv2_config(char *arg)
+{
+	struct sv2_map *m = &maps[nmaps];
+	struct addrinfo *ai;
+	char *eq = strchr(arg, '='), *opt, *next, *host, *pool;
+	if (nmaps == SV2_MAX || !eq)
+		return -1;
+	*eq++ = 0;
+	if ((opt = strchr(eq, ',')))
+		*opt++ = 0;
+	memset(m, 0, sizeof *m);
+	for (; opt; opt = next)
+	{
+		if ((next = strchr(opt, ',')))
+			*next++ = 0;
+		if (!strncmp(opt, "user=", 5) && strlen(opt + 5) < sizeof m->user)
+			strcpy(m->user, opt + 5);
+		else if (!strncmp(opt, "key=", 4) && !parse_key(opt + 4, m->key))
+			m->have_key = 1;
+		else if (!strcmp(opt, "plain"))
+			m->plain = 1;
+		else
+			return -1;
+	}
+	/* the channel opens right after the setup, miners wait for the
+	   subscribe result before they authorize */
+	if (!m->user[0])
+		return -1;
+	if (split_hostport(arg, &host, &m->port) || strlen(host) >= sizeof m->host ||
+		split_hostport(eq, &pool, &m->poolport) || strlen(pool) >= sizeof m->pool)
+		return -1;
+	strcpy(m->host, host);
+	strcpy(m->pool, pool);
+	if (resolve(pool, m->poolport, &ai))
+		return -1;
+	memcpy(&m->addr, ai->ai_addr, ai->ai_addrlen);
+	m->addrlen = ai->ai_addrlen;
+	freeaddrinfo(ai);
+	nmaps++;
+	return 0;
+}
+
+struct sv2_map *sv2_find(const char *host, unsigned short port)
+{
+	unsigned i;
+	for (i = 0; i < nmaps; i++)
+		if (maps[i].port == port && !strcasecmp(maps[i].host, host))
+			return &maps[i];
+	return 0;
+}
+
+int sv2_connect(struct sv2_map *m, int timeout_ms)
+{
+	int err, fd = socket(m->addr.v4.sin_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+	socklen_t errlen = sizeof err;
+	if (fd == -1)
+		return -1;
+	if (connect(fd, (void *)&m->addr, m->addrlen) == -1)
+	{
+		if (errno != EINPROGRESS)
+			goto fail;
+		if ((err = coro_poll(&pfd, 1, timeout_ms)) <= 0)
+		{
+			if (err == 0)
+				errno = ETIMEDOUT;
+			goto fail;
+		}
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1)
+			goto fail;
+		if (err)
+		{
+			errno = err;
+			goto fail;
+		}
+	}
+	return fd;
+fail:
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+static int send_all(int fd, const void *buf, size_t n)
+{
+	const char *b = buf;
+	while (n)
+	{
+		ssize_t m = coro_write(fd, b, n);
+		if (m < 0)
+			return -1;
+		b += m;
+		n -= m;
+	}
+	return 0;
+}
+
+/* v1 output, gathered per input and sent with one write */
+
+static int out_reserve(struct session *s, size_t n)
+{
+	char *p;
+	size_t cap = s->outcap ? s->outcap : 4096;
+	if (s->outlen + n <= s->outcap)
+		return 0;
+	while (cap < s->outlen + n)
+		cap *= 2;
+	if (!(p = realloc(s->out, cap)))
+		return -1;
+	s->out = p;
+	s->outcap = cap;
+	return 0;
+}
+
+static void out_printf(struct session *s, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void out_printf(struct session *s, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+	if (out_reserve(s, 256))
+		return;
+	va_start(ap, fmt);
+	n = vsnprintf(s->out + s->outlen, s->outcap - s->outlen, fmt, ap);
+	va_end(ap);
+	if (n >= 0 && (size_t)n >= s->outcap - s->outlen)
+	{
+		if (out_reserve(s, n + 1))
+			return;
+		va_start(ap, fmt);
+		vsnprintf(s->out + s->outlen, s->outcap - s->outlen, fmt, ap);
+		va_end(ap);
+	}
+	if (n > 0)
+		s->outlen += n;
+}
+
+static void out_hex(struct session *s, const unsigned char *p, size_t n)
+{
+	static const char digits[] = "0123456789abcdef";
+	if (out_reserve(s, 2 * n))
+		return;
+	while (n--)
+	{
+		s->out[s->outlen++] = digits[*p >> 4];
+		s->out[s->outlen++] = digits[*p++ & 15];
+	}
+}
+
+static int out_flush(struct session *s)
+{
+	int ret = s->outlen ? send_all(s->miner, s->out, s->outlen) : 0;
+	__atomic_add_fetch(&miner_bytes, s->outlen, __ATOMIC_RELAXED);
+	s->outlen = 0;
+	return ret;
+}
+
+/* v2 framing, all integers are little endian */
+
+struct rd
+{
+	const unsigned char *p, *end;
+	int err;
+};
+
+static const unsigned char *rd_bytes(struct rd *r, size_t n)
+{
+	const unsigned char *p = r->p;
+	if (r->err || (size_t)(r->end - r->p) < n)
+	{
+		r->err = 1;
+		return 0;
+	}
+	r->p += n;
+	return p;
+}
+
+static unsigned long long rd_uint(struct rd *r, int n)
+{
+	const unsigned char *p = rd_bytes(r, n);
+	unsigned long long v = 0;
+	while (p && n--)
+		v = v << 8 | p[n];
+	return v;
+}
+
+struct wr
+{
+	unsigned char buf[1024];
+	size_t len;
+};
+
+static void wr_uint(struct wr *w, unsigned long long v, int n)
+{
+	while (n-- && w->len < sizeof w->buf)
+	{
+		w->buf[w->len++] = v;
+		v >>= 8;
+	}
+}
+
+static void wr_bytes(struct wr *w, const void *p, size_t n)
+{
+	if (n > sizeof w->buf - w->len)
+		n = sizeof w->buf - w->len;
+	memcpy(w->buf + w->len, p, n);
+	w->len += n;
+}
+
+/* STR0_255 and B0_32 */
+static void wr_str(struct wr *w, const void *p, size_t n)
+{
+	if (n > 255)
+		n = 255;
+	wr_uint(w, n, 1);
+	wr_bytes(w, p, n);
+}
+
+static void wr_begin(struct wr *w)
+{
+	w->len = HEADER;
+}
+
+static int wr_send(struct session *s, struct wr *w, unsigned ext, unsigned type)
+{
+	size_t len = w->len - HEADER;
+	w->buf[0] = ext;
+	w->buf[1] = ext >> 8;
+	w->buf[2] = type;
+	w->buf[3] = len;
+	w->buf[4] = len >> 8;
+	w->buf[5] = len >> 16;
+	if (s->noise)
+	{
+		/* the header and the payload are encrypted apart, a payload of
+		   this size is a single message */
+		unsigned char sealed[sizeof w->buf + 2 * NOISE_MAC];
+		noise_encrypt(&s->noise->tx, sealed, w->buf, HEADER);
+		if (len)
+			noise_encrypt(&s->noise->tx, sealed + HEADER + NOISE_MAC, w->buf + HEADER, len);
+		return send_all(s->pool, sealed, w->len + (len ? 2 : 1) * NOISE_MAC);
+	}
+	return send_all(s->pool, w->buf, w->len);
+}
+
+/* the noise handshake, before anything else goes to the pool */
+static int handshake(struct session *s)
+{
+	struct pollfd pfd = {.fd = s->pool, .events = POLLIN};
+	unsigned char buf[NOISE_REPLY];
+	const char *why = "no answer to the handshake";
+	size_t got = 0;
+	ssize_t n;
+	if (noise_hello(s->noise, buf) || send_all(s->pool, buf, NOISE_HELLO))
+		return -1;
+	while (got < sizeof buf)
+	{
+		if ((n = coro_poll(&pfd, 1, 10000)) == -1 && errno == EINTR)
+			continue;
+		if (n <= 0 || (n = coro_read(s->pool, buf + got, sizeof buf - got)) <= 0)
+			goto fail;
+		got += n;
+	}
+	__atomic_add_fetch(&pool_bytes, got, __ATOMIC_RELAXED);
+	if (!noise_reply(s->noise, buf, s->map->have_key ? s->map->key : 0, &why))
+		return 0;
+fail:
+	dprintf(2, "sv2: noise handshake with %s failed: %s\n", s->map->pool, why);
+	return -1;
+}
+
+static int send_setup(struct session *s)
+{
+	struct wr w;
+	wr_begin(&w);
+	wr_uint(&w, 0, 1); /* mining protocol */
+	wr_uint(&w, 2, 2); /* min and max version */
+	wr_uint(&w, 2, 2);
+	wr_uint(&w, 0, 4); /* flags */
+	wr_str(&w, s->map->pool, strlen(s->map->pool));
+	wr_uint(&w, s->map->poolport, 2);
+	wr_str(&w, "microsocks", 10);
+	wr_str(&w, "", 0);
+	wr_str(&w, "", 0);
+	wr_str(&w, "", 0);
+	return wr_send(s, &w, 0, SETUP_CONNECTION);
+}
+
+static int send_open(struct session *s)
+{
+	static const unsigned char max_target[32] = {
+		255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+		255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255};
+	float rate = 1e12;
+	unsigned bits;
+	struct wr w;
+	memcpy(&bits, &rate, sizeof bits);
+	wr_begin(&w);
+	wr_uint(&w, 1, 4); /* request id */
+	wr_str(&w, s->map->user, strlen(s->map->user));
+	wr_uint(&w, bits, 4);
+	wr_bytes(&w, max_target, 32);
+	wr_uint(&w, 4, 2); /* v1 miners usually roll 4 bytes of extranonce2 */
+	s->opened = 1;
+	return wr_send(s, &w, 0, OPEN_EXTENDED_CHANNEL);
+}
+
+/* v1 difficulty 1 is a target of 0xffff * 2^208 */
+static double target_diff(const unsigned char *t)
+{
+	double v = 0;
+	int i;
+	for (i = 31; i >= 0; i--)
+		v = v * 256 + t[i];
+	return v ? 0xffff * 411376139330301510538742295639337626245683966408394965837152256.0 / v : 0;
+}
+
+static void notify_difficulty(struct session *s)
+{
+	if (s->subscribed && s->diff)
+		out_printf(s, "{\"id\":null,\"method\":\"mining.set_difficulty\",\"params\":[%.17g]}\n", s->diff);
+}
+
+static struct job *job_find(struct session *s, unsigned id)
+{
+	int i;
+	for (i = 0; i < JOBS; i++)
+		if (s->jobs[i].used && s->jobs[i].id == id)
+			return &s->jobs[i];
+	return 0;
+}
+
+static void notify_job(struct session *s, struct job *j, unsigned ntime, int clean)
+{
+	int i;
+	if (!s->subscribed || !s->have_prev || !j)
+		return;
+	out_printf(s, "{\"id\":null,\"method\":\"mining.notify\",\"params\":[\"%x\",\"", j->id);
+	/* v1 wants every 4 byte word of the previous hash reversed */
+	for (i = 0; i < 32; i += 4)
+	{
+		unsigned char w[4] = {s->prev[i + 3], s->prev[i + 2], s->prev[i + 1], s->prev[i]};
+		out_hex(s, w, 4);
+	}
+	out_printf(s, "\",%s,\"%08x\",\"%08x\",\"%08x\",%s]}\n", j->v1, j->version, s->nbits, ntime,
+			   clean ? "true" : "false");
+	__atomic_add_fetch(&jobs, 1, __ATOMIC_RELAXED);
+}
+
+static void subscribe_reply(struct session *s)
+{
+	out_printf(s, "{\"id\":%s,\"result\":[[[\"mining.set_difficulty\",\"1\"],[\"mining.notify\",\"1\"]],\"",
+			   s->sub_id);
+	out_hex(s, s->extranonce, s->extranonce_len);
+	out_printf(s, "\",%u],\"error\":null}\n", s->extranonce_size);
+	s->sub_id[0] = 0;
+	s->subscribed = 1;
+	notify_difficulty(s);
+	notify_job(s, job_find(s, s->prev_job), s->ntime, 1);
+}
+
+static void channel_ready(struct session *s)
+{
+	if (!s->open)
+		return;
+	if (s->sub_id[0])
+		subscribe_reply(s);
+	if (s->auth_id[0])
+	{
+		out_printf(s, "{\"id\":%s,\"result\":true,\"error\":null}\n", s->auth_id);
+		s->auth_id[0] = 0;
+	}
+}
+
+static void fail_pending(struct session *s, const char *why)
+{
+	if (s->sub_id[0])
+		out_printf(s, "{\"id\":%s,\"result\":null,\"error\":[20,\"%s\",null]}\n", s->sub_id, why);
+	if (s->auth_id[0])
+		out_printf(s, "{\"id\":%s,\"result\":false,\"error\":[24,\"%s\",null]}\n", s->auth_id, why);
+	s->sub_id[0] = s->auth_id[0] = 0;
+}
+
+/* the printable part of a v2 error code */
+static void error_code(struct rd *r, char *buf, size_t size)
+{
+	size_t n = rd_uint(r, 1), i, o = 0;
+	const unsigned char *p = rd_bytes(r, n);
+	for (i = 0; p && i < n && o + 1 < size; i++)
+		if (p[i] >= 32 && p[i] < 127 && p[i] != '"' && p[i] != '\\')
+			buf[o++] = p[i];
+	buf[o] = 0;
+}
+
+static void new_job(struct session *s, struct rd *r)
+{
+	unsigned id, version, min_ntime = 0, n, i;
+	int future;
+	size_t plen, slen, need;
+	const unsigned char *path, *prefix, *suffix;
+	rd_uint(r, 4); /* channel */
+	id = rd_uint(r, 4);
+	if ((future = !rd_uint(r, 1)) == 0)
+		min_ntime = rd_uint(r, 4);
+	version = rd_uint(r, 4);
+	rd_uint(r, 1); /* version rolling allowed */
+	n = rd_uint(r, 1);
+	path = rd_bytes(r, 32 * n);
+	plen = rd_uint(r, 2);
+	prefix = rd_bytes(r, plen);
+	slen = rd_uint(r, 2);
+	suffix = rd_bytes(r, slen);
+	if (r->err)
+		return;
+	struct job *j = job_find(s, id);
+	if (!j)
+		j = &s->jobs[s->nextjob++ % JOBS];
+	need = 2 * (plen + slen) + 67 * n + 16;
+	if (need > j->cap)
+	{
+		char *p = realloc(j->v1, need);
+		if (!p)
+			return;
+		j->v1 = p;
+		j->cap = need;
+	}
+	/* render the static part of the notify right away, into the
+	   session's output buffer which is empty between inputs */
+	size_t mark = s->outlen;
+	out_printf(s, "\"");
+	out_hex(s, prefix, plen);
+	out_printf(s, "\",\"");
+	out_hex(s, suffix, slen);
+	out_printf(s, "\",[");
+	for (i = 0; i < n; i++)
+	{
+		out_printf(s, i ? ",\"" : "\"");
+		out_hex(s, path + 32 * i, 32);
+		out_printf(s, "\"");
+	}
+	out_printf(s, "]");
+	if (s->outlen - mark >= j->cap)
+	{
+		s->outlen = mark;
+		return;
+	}
+	memcpy(j->v1, s->out + mark, s->outlen - mark);
+	j->v1[s->outlen - mark] = 0;
+	s->outlen = mark;
+	j->used = 1;
+	j->id = id;
+	j->version = version;
+	j->future = future;
+	j->min_ntime = min_ntime;
+	if (!future)
+		notify_job(s, j, min_ntime, 0);
+}
+
+static void submit_result(struct session *s, unsigned seq, int ok, const char *why)
+{
+	int i;
+	for (i = 0; i < PENDING; i++)
+	{
+		if (!s->pending[i].used || (ok ? (int)(seq - s->pending[i].seq) < 0 : s->pending[i].seq != seq))
+			continue;
+		if (ok)
+			out_printf(s, "{\"id\":%s,\"result\":true,\"error\":null}\n", s->pending[i].id);
+		else
+			out_printf(s, "{\"id\":%s,\"result\":false,\"error\":[23,\"%s\",null]}\n", s->pending[i].id, why);
+		__atomic_add_fetch(ok ? &accepted : &rejected, 1, __ATOMIC_RELAXED);
+		s->pending[i].used = 0;
+	}
+}
+
+/* returns -1 if the session has to end */
+static int pool_message(struct session *s, unsigned type, const unsigned char *p, size_t len)
+{
+	struct rd r = {p, p + len, 0};
+	char why[64];
+	unsigned id;
+	switch (type)
+	{
+	case SETUP_CONNECTION_SUCCESS:
+		s->setup = 1;
+		if (!s->opened)
+			return send_open(s);
+		break;
+	case SETUP_CONNECTION_ERROR:
+		rd_uint(&r, 4);
+		error_code(&r, why, sizeof why);
+		dprintf(2, "sv2: %s refused the connection: %s\n", s->map->pool, why);
+		fail_pending(s, why);
+		return -1;
+	case OPEN_EXTENDED_CHANNEL_SUCCESS:
+		rd_uint(&r, 4);
+		s->channel = rd_uint(&r, 4);
+		if ((p = rd_bytes(&r, 32)))
+			s->diff = target_diff(p);
+		s->extranonce_size = rd_uint(&r, 2);
+		s->extranonce_len = rd_uint(&r, 1);
+		if (s->extranonce_len > sizeof s->extranonce || !rd_bytes(&r, s->extranonce_len))
+			return -1;
+		memcpy(s->extranonce, r.p - s->extranonce_len, s->extranonce_len);
+		s->open = 1;
+		channel_ready(s);
+		break;
+	case OPEN_CHANNEL_ERROR:
+		rd_uint(&r, 4);
+		error_code(&r, why, sizeof why);
+		fail_pending(s, why);
+		return -1;
+	case SET_TARGET:
+		rd_uint(&r, 4);
+		if ((p = rd_bytes(&r, 32)))
+		{
+			s->diff = target_diff(p);
+			notify_difficulty(s);
+		}
+		break;
+	case SET_EXTRANONCE_PREFIX:
+		rd_uint(&r, 4);
+		id = rd_uint(&r, 1);
+		if (id > sizeof s->extranonce || !rd_bytes(&r, id))
+			break;
+		memcpy(s->extranonce, r.p - id, id);
+		s->extranonce_len = id;
+		if (s->subscribed)
+		{
+			out_printf(s, "{\"id\":null,\"method\":\"mining.set_extranonce\",\"params\":[\"");
+			out_hex(s, s->extranonce, s->extranonce_len);
+			out_printf(s, "\",%u]}\n", s->extranonce_size);
+		}
+		break;
+	case NEW_EXTENDED_JOB:
+		new_job(s, &r);
+		break;
+	case SET_NEW_PREV_HASH:
+		rd_uint(&r, 4);
+		id = rd_uint(&r, 4);
+		if (!rd_bytes(&r, 32))
+			break;
+		memcpy(s->prev, r.p - 32, 32);
+		s->ntime = rd_uint(&r, 4);
+		s->nbits = rd_uint(&r, 4);
+		s->prev_job = id;
+		s->have_prev = !r.err;
+		notify_job(s, job_find(s, id), s->ntime, 1);
+		break;
+	case SUBMIT_SHARES_SUCCESS:
+		rd_uint(&r, 4);
+		id = rd_uint(&r, 4);
+		if (!r.err)
+			submit_result(s, id, 1, 0);
+		break;
+	case SUBMIT_SHARES_ERROR:
+		rd_uint(&r, 4);
+		id = rd_uint(&r, 4);
+		error_code(&r, why, sizeof why);
+		if (!r.err)
+			submit_result(s, id, 0, why);
+		break;
+	}
+	return 0;
+}
+
+/* pick the raw "id" and the string params out of a v1 line */
+static int parse_line(const char *line, char *id, char *store, size_t size, char **argv, int max)
+{
+	const char *p = strstr(line, "\"id\"");
+	size_t n;
+	int argc = 0;
+	id[0] = 0;
+	if (p && (p = strchr(p + 4, ':')))
+	{
+		for (p++; *p == ' '; p++)
+			;
+		n = strcspn(p, ",}");
+		while (n && p[n - 1] == ' ')
+			n--;
+		if (n && n < ID_LEN)
+			memcpy(id, p, n), id[n] = 0;
+	}
+	if (!(p = strstr(line, "\"params\"")) || !(p = strchr(p, '[')))
+		return 0;
+	for (p++; argc < max;)
+	{
+		while (*p == ' ')
+			p++;
+		if (*p == ']' || !*p)
+			break;
+		if (*p == '"')
+			n = strcspn(++p, "\"");
+		else
+			n = strcspn(p, ",]");
+		if (n >= size)
+			break;
+		memcpy(store, p, n);
+		store[n] = 0;
+		argv[argc++] = store;
+		store += n + 1;
+		size -= n + 1;
+		p += n;
+		if (*p == '"')
+			p++;
+		while (*p == ' ')
+			p++;
+		if (*p != ',')
+			break;
+		p++;
+	}
+	return argc;
+}
+
+static int method_is(const char *line, const char *method)
+{
+	const char *p = strstr(line, "\"method\"");
+	size_t n = strlen(method);
+	if (!p || !(p = strchr(p + 8, '"')))
+		return 0;
+	return !strncmp(p + 1, method, n) && p[1 + n] == '"';
+}
+
+static int hexval(const char *h, unsigned char *out, size_t max)
+{
+	size_t n = strlen(h) / 2, i;
+	unsigned v;
+	if (n > max || strlen(h) % 2)
+		return -1;
+	for (i = 0; i < n; i++)
+	{
+		if (sscanf(h + 2 * i, "%2x", &v) != 1)
+			return -1;
+		out[i] = v;
+	}
+	return n;
+}
+
+static int submit(struct session *s, const char *id, char **argv, int argc)
+{
+	unsigned char extranonce[32];
+	struct job *j;
+	struct wr w;
+	int n;
+	if (!s->open || argc < 5)
+	{
+		out_printf(s, "{\"id\":%s,\"result\":false,\"error\":[25,\"not subscribed\",null]}\n", id);
+		return 0;
+	}
+	if (!(j = job_find(s, strtoul(argv[1], 0, 16))))
+	{
+		out_printf(s, "{\"id\":%s,\"result\":false,\"error\":[21,\"job not found\",null]}\n", id);
+		__atomic_add_fetch(&rejected, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	if ((n = hexval(argv[2], extranonce, sizeof extranonce)) < 0)
+	{
+		out_printf(s, "{\"id\":%s,\"result\":false,\"error\":[20,\"bad extranonce2\",null]}\n", id);
+		return 0;
+	}
+	unsigned version = j->version;
+	/* rolled version bits, BIP 320 */
+	if (argc > 5)
+		version = (version & ~0x1fffe000u) | (strtoul(argv[5], 0, 16) & 0x1fffe000u);
+	unsigned seq = ++s->seq, slot = seq % PENDING;
+	s->pending[slot].used = 1;
+	s->pending[slot].seq = seq;
+	strcpy(s->pending[slot].id, id);
+	wr_begin(&w);
+	wr_uint(&w, s->channel, 4);
+	wr_uint(&w, seq, 4);
+	wr_uint(&w, j->id, 4);
+	wr_uint(&w, strtoul(argv[4], 0, 16), 4); /* nonce */
+	wr_uint(&w, strtoul(argv[3], 0, 16), 4); /* ntime */
+	wr_uint(&w, version, 4);
+	wr_str(&w, extranonce, n);
+	return wr_send(s, &w, CHANNEL_MSG, SUBMIT_SHARES_EXTENDED);
+}
+
+static int miner_line(struct session *s, const char *line)
+{
+	char id[ID_LEN], store[LINE], *argv[8];
+	int argc = parse_line(line, id, store, sizeof store, argv, 8);
+	if (!id[0])
+		strcpy(id, "null");
+	if (method_is(line, "mining.submit"))
+		return submit(s, id, argv, argc);
+	if (method_is(line, "mining.subscribe"))
+	{
+		strcpy(s->sub_id, id);
+		channel_ready(s);
+	}
+	else if (method_is(line, "mining.authorize"))
+	{
+		strcpy(s->auth_id, id);
+		channel_ready(s);
+	}
+	else if (method_is(line, "mining.configure"))
+		out_printf(s, "{\"id\":%s,\"result\":{},\"error\":null}\n", id);
+	else if (method_is(line, "mining.extranonce.subscribe"))
+		out_printf(s, "{\"id\":%s,\"result\":true,\"error\":null}\n", id);
+	else if (strcmp(id, "null"))
+		out_printf(s, "{\"id\":%s,\"result\":null,\"error\":[20,\"unsupported\",null]}\n", id);
+	return 0;
+}
+
+static int miner_input(struct session *s, const char *buf, size_t n)
+{
+	const char *nl;
+	size_t seg;
+	while (n)
+	{
+		nl = memchr(buf, '\n', n);
+		seg = nl ? (size_t)(nl - buf) : n;
+		if (s->linelen + seg < LINE)
+		{
+			memcpy(s->line + s->linelen, buf, seg);
+			s->linelen += seg;
+		}
+		else
+			s->skip = 1;
+		if (!nl)
+			break;
+		s->line[s->linelen] = 0;
+		if (!s->skip && miner_line(s, s->line))
+			return -1;
+		s->linelen = s->skip = 0;
+		buf = nl + 1;
+		n -= seg + 1;
+	}
+	return 0;
+}
+
+/* with noise a frame is the encrypted header followed by the payload,
+   encrypted in messages of at most NOISE_MAX bytes each */
+static size_t sealed_len(size_t len)
+{
+	return len + (len + NOISE_MAX - NOISE_MAC - 1) / (NOISE_MAX - NOISE_MAC) * NOISE_MAC;
+}
+
+/* decrypts a whole frame in place, into a plain header and payload */
+static int unseal(struct session *s, unsigned char *f, size_t len)
+{
+	unsigned char *in = f + HEADER + NOISE_MAC, *out = f + HEADER;
+	size_t n;
+	if (noise_decrypt(&s->noise->rx, f, f, HEADER + NOISE_MAC))
+		return -1;
+	for (; len; len -= n, in += n + NOISE_MAC, out += n)
+	{
+		n = len < NOISE_MAX - NOISE_MAC ? len : NOISE_MAX - NOISE_MAC;
+		if (noise_decrypt(&s->noise->rx, out, in, n + NOISE_MAC))
+			return -1;
+	}
+	return 0;
+}
+
+static int pool_input(struct session *s)
+{
+	size_t off = 0, hlen = s->noise ? HEADER + NOISE_MAC : HEADER;
+	while (s->framelen - off >= hlen)
+	{
+		unsigned char *h = s->frame + off, head[HEADER];
+		size_t len, size;
+		memcpy(head, h, HEADER);
+		if (s->noise)
+		{
+			/* peek at the header, it is decrypted for good with the rest */
+			struct noise_cipher rx = s->noise->rx;
+			if (noise_decrypt(&rx, head, h, hlen))
+				return -1;
+		}
+		len = head[3] | head[4] << 8 | (size_t)head[5] << 16;
+		size = s->noise ? hlen + sealed_len(len) : HEADER + len;
+		if (s->framelen - off < size)
+		{
+			/* make room for the rest of a big frame */
+			if (size > s->framecap)
+			{
+				unsigned char *p = realloc(s->frame, size);
+				if (!p)
+					return -1;
+				s->frame = p;
+				s->framecap = size;
+			}
+			break;
+		}
+		if (s->noise && unseal(s, h, len))
+			return -1;
+		/* extensions are not spoken, skip their messages */
+		if (!((h[0] | h[1] << 8) & ~CHANNEL_MSG) && pool_message(s, h[2], h + HEADER, len))
+			return -1;
+		off += size;
+	}
+	memmove(s->frame, s->frame + off, s->framelen - off);
+	s->framelen -= off;
+	return 0;
+}
+
+enum trace_close sv2_relay(struct sv2_map *m, int miner, int pool)
+{
+	struct pollfd fds[2] = {
+		{.fd = miner, .events = POLLIN},
+		{.fd = pool, .events = POLLIN},
+	};
+	enum trace_close why = TC_ERROR;
+	struct session *s = calloc(1, sizeof *s);
+	char buf[4096];
+	int i, one = 1;
+	if (!s || !(s->frame = malloc(s->framecap = 65536)))
+	{
+		free(s);
+		return TC_NOMEM;
+	}
+	s->map = m;
+	s->miner = miner;
+	s->pool = pool;
+	/* output is written once per input read already, nagle would only
+	   hold jobs and share results back until the peer's delayed ack */
+	setsockopt(miner, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+	setsockopt(pool, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+	__atomic_add_fetch(&sessions, 1, __ATOMIC_RELAXED);
+	if (!m->plain && (!(s->noise = malloc(sizeof *s->noise)) || handshake(s)))
+		goto out;
+	if (send_setup(s))
+		goto out;
+	while (1)
+	{
+		/* idle sessions are reaped after 15 min, like plain tunnels */
+		switch (coro_poll(fds, 2, 60 * 15 * 1000))
+		{
+		case 0:
+			why = TC_IDLE;
+			goto out;
+		case -1:
+			if (errno == EINTR)
+				continue;
+			goto out;
+		}
+		if (fds[0].revents)
+		{
+			ssize_t n = coro_read(miner, buf, sizeof buf);
+			if (n <= 0)
+			{
+				why = n ? TC_ERROR : TC_EOF;
+				goto out;
+			}
+			if (miner_input(s, buf, n))
+				goto out;
+		}
+		if (fds[1].revents)
+		{
+			ssize_t n = coro_read(pool, s->frame + s->framelen, s->framecap - s->framelen);
+			if (n <= 0)
+			{
+				/* a pool that requires noise takes SetupConnection for a
+				   broken handshake and hangs up */
+				if (!s->setup && m->plain)
+					dprintf(2, "sv2: %s closed the connection before the setup, "
+							   "it may require the noise handshake\n", m->pool);
+				why = n ? TC_ERROR : TC_EOF;
+				goto out;
+			}
+			__atomic_add_fetch(&pool_bytes, n, __ATOMIC_RELAXED);
+			s->framelen += n;
+			if (pool_input(s))
+				goto out;
+		}
+		if (out_flush(s))
+			goto out;
+	}
+out:
+	out_flush(s);
+	for (i = 0; i < JOBS; i++)
+		free(s->jobs[i].v1);
+	free(s->out);
+	free(s->frame);
+	if (s->noise)
+		memset(s->noise, 0, sizeof *s->noise);
+	free(s->noise);
+	free(s);
+	return why;
+}
+
+void sv2_dump(int fd)
+{
+	if (!nmaps)
+		return;
+	dprintf(fd, "sv2: %llu sessions, %llu jobs, shares accepted %llu rejected %llu, "
+				"bytes v2 pool %llu v1 miners %llu\n",
+			__atomic_load_n(&sessions, __ATOMIC_RELAXED), __atomic_load_n(&jobs, __ATOMIC_RELAXED),
+			__atomic_load_n(&accepted, __ATOMIC_RELAXED), __atomic_load_n(&rejected, __ATOMIC_RELAXED),
+			__atomic_load_n(&pool_bytes, __ATOMIC_RELAXED), __atomic_load_n(&miner_bytes, __ATOMIC_RELAXED));
+}
+
+#else
+
+int sv2_config(char *arg)
+{
+	return -1;
+}
+
+struct sv2_map *sv2_find(const char *host, unsigned short port)
+{
+	return 0;
+}
+
+int sv2_connect(struct sv2_map *m, int timeout_ms)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+enum trace_close sv2_relay(struct sv2_map *m, int miner, int pool)
+{
+	return TC_ERROR;
+}
+
+void sv2_dump(int fd)
+{
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef SV2_H
+#define SV2_H
+
+#include "inspect.h"
+#include "trace.h"
+
+//RcB: DEP "sv2.c"
+
+/* stratum v1 to v2 translation. a tunnel requested to a mapped v1 pool
+   is connected to a v2 pool instead, and the session is translated:
+   the miner keeps talking v1 json lines, the pool gets binary v2 frames
+   on an extended channel, opened with the configured identity as soon
+   as the pool accepted the connection. subscribe and authorize are
+   answered once the channel is open, jobs and prevhash updates turn into mining.notify, targets into
+   mining.set_difficulty and mining.submit into SubmitSharesExtended,
+   whose results are passed back.
+   the pool leg is encrypted with the noise handshake of stratum v2, see
+   noise.h. with key= the pool's certificate has to be signed by that
+   authority, without it the leg is encrypted but the pool is not
+   authenticated. plain speaks the plaintext transport instead, for
+   pools on the same host. -DCONFIG_STRATUM=0 leaves the translation
+   out, -V is then rejected. */
+
+#define SV2_MAX 8
+
+struct sv2_map;
+
+/* parse "v1host:v1port=v2host:v2port,user=identity[,key=authority][,plain]".
+   returns 0 on success. */
+int sv2_config(char *arg);
+/* the mapping for a requested destination, if any */
+struct sv2_map *sv2_find(const char *host, unsigned short port);
+/* connect to the v2 pool, returns a non-blocking fd or -1 with errno set */
+int sv2_connect(struct sv2_map *m, int timeout_ms);
+/* translate between the v1 miner and the v2 pool until either goes away */
+enum trace_close sv2_relay(struct sv2_map *m, int miner, int pool);
+void sv2_dump(int fd);
+
+#endif
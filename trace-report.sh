@@ -0,0 +1,47 @@
+#!/bin/sh
+# breakdown of the slowest sessions in a flight recorder dump, e.g.
+#   echo trace | nc -U /run/microsocks.admin | ./trace-report.sh 20
+# or from the SIGUSR2 output on stderr. times are in milliseconds:
+#   queue    accept until the session thread or coroutine ran
+#   hshake   until the method, and the credentials if any, were checked
+#   resolve  dns lookup
+#   connect  connect to the target or through the parent proxy
+#   up/down  from the established tunnel to the first byte each way
+#   total    accept until close, or until the last event if still open
+n=${1:-20}
+[ $# -gt 0 ] && shift
+cat "$@" | awk -v n="$n" '
+function field(line, key,    r) {
+	if (!match(line, "\"" key "\":\"?[^,}\"]*"))
+		return ""
+	r = substr(line, RSTART + length(key) + 3, RLENGTH - length(key) - 3)
+	sub(/^"/, "", r)
+	return r
+}
+function ms(a, b) {
+	return (a != "" && b != "") ? sprintf("%.1f", (b - a) / 1e6) : "-"
+}
+/"e":/ {
+	s = field($0, "s"); e = field($0, "e"); t = field($0, "t") + 0
+	if (!(s in first) || t < first[s]) first[s] = t
+	if (!(s in last) || t > last[s]) last[s] = t
+	ts[s, e] = t
+	if (e == "close") why[s] = field($0, "a")
+	if (e == "connect_end" && field($0, "a") != "0") err[s] = " errno " field($0, "a")
+}
+END {
+	for (s in first) {
+		a = ((s, "accept") in ts) ? ts[s, "accept"] : first[s]
+		end = ((s, "close") in ts) ? ts[s, "close"] : last[s]
+		hs = ((s, "auth") in ts) ? ts[s, "auth"] : ts[s, "method"]
+		est = ts[s, "connect_end"]
+		printf "%.1f\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n", (end - a) / 1e6, s,
+			ms(a, ts[s, "start"]), ms(ts[s, "start"], hs),
+			ms(ts[s, "resolve_start"], ts[s, "resolve_end"]),
+			ms(ts[s, "connect_start"], est),
+			ms(est, ts[s, "first_up"]), ms(est, ts[s, "first_down"]),
+			((s in why) ? why[s] : "open") err[s]
+	}
+}' | sort -rn | head -n "$n" | awk -F '\t' '
+BEGIN { printf "%9s %8s %7s %7s %8s %8s %8s %8s  %s\n", "total", "session", "queue", "hshake", "resolve", "connect", "up", "down", "end" }
+{ printf "%9s %8s %7s %7s %8s %8s %8s %8s  %s\n", $1, $2, $3, $4, $5, $6, $7, $8, $9 }'
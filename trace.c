@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_RINGS 64
+
+struct entry
+{
+	/* index + 1 once the entry is complete, 0 while it's written */
+	unsigned long long seq;
+	unsigned long long ns;
+	unsigned session;
+	short event, arg;
+};
+
+struct ring
+{
+	unsigned long long head;
+	struct entry *entries;
+} __attribute__((aligned(64)));
+
+static struct ring rings[TRACE_RINGS];
+static unsigned long long mask;
+static unsigned sessions, next_ring;
+static __thread int my_ring = -1;
+
+static const char *const event_names[TR_EVENTS] = {
+	[TR_ACCEPT] = "accept",
+	[TR_START] = "start",
+	[TR_METHOD] = "method",
+	[TR_AUTH] = "auth",
+	[TR_RESOLVE_START] = "resolve_start",
+	[TR_RESOLVE_END] = "resolve_end",
+	[TR_CONNECT_START] = "connect_start",
+	[TR_CONNECT_END] = "connect_end",
+	[TR_FIRST_UP] = "first_up",
+	[TR_FIRST_DOWN] = "first_down",
+	[TR_CLOSE] = "close",
+};
+
+static const char *const close_names[TC_REASONS] = {
+	[TC_CLIENT] = "client",
+	[TC_REJECTED] = "rejected",
+	[TC_EOF] = "eof",
+	[TC_IDLE] = "idle",
+	[TC_ERROR] = "error",
+	[TC_NOMEM] = "nomem",
+};
+
+int trace_config(unsigned entries)
+{
+	unsigned long long n;
+	struct entry *all;
+	unsigned i;
+	if (!entries)
+	{
+		mask = 0;
+		return 0;
+	}
+	for (n = 16; n < entries; n *= 2)
+		;
+	/* the pages of a ring are only touched once its thread records */
+	if (!(all = calloc(TRACE_RINGS * n, sizeof *all)))
+		return -1;
+	for (i = 0; i < TRACE_RINGS; i++)
+		rings[i].entries = all + i * n;
+	mask = n - 1;
+	return 0;
+}
+
+unsigned trace_session(void)
+{
+	return __atomic_add_fetch(&sessions, 1, __ATOMIC_RELAXED);
+}
+
+void trace(unsigned session, enum trace_event ev, int arg)
+{
+	struct timespec ts;
+	if (!mask)
+		return;
+	/* rings are handed out round robin, beyond TRACE_RINGS threads share */
+	if (my_ring < 0)
+		my_ring = __atomic_fetch_add(&next_ring, 1, __ATOMIC_RELAXED) % TRACE_RINGS;
+	struct ring *r = &rings[my_ring];
+	unsigned long long i = __atomic_fetch_add(&r->head, 1, __ATOMIC_RELAXED);
+	struct entry *e = &r->entries[i & mask];
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	__atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&e->ns, ts.tv_sec * 1000000000ULL + ts.tv_nsec, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->session, session, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->event, ev, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->arg, arg, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->seq, i + 1, __ATOMIC_RELEASE);
+}
+
+struct out
+{
+	int fd;
+	size_t len;
+	char buf[16384];
+};
+
+static void flush(struct out *o)
+{
+	size_t done = 0;
+	while (done < o->len)
+	{
+		ssize_t n = write(o->fd, o->buf + done, o->len - done);
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	o->len = 0;
+}
+
+void trace_dump(int fd)
+{
+	struct out *o = malloc(sizeof *o);
+	unsigned r;
+	if (!mask || !o)
+	{
+		free(o);
+		return;
+	}
+	o->fd = fd;
+	o->len = 0;
+	for (r = 0; r < TRACE_RINGS; r++)
+	{
+		unsigned long long head = __atomic_load_n(&rings[r].head, __ATOMIC_ACQUIRE), i;
+		for (i = head > mask ? head - mask - 1 : 0; i < head; i++)
+		{
+			struct entry *e = &rings[r].entries[i & mask], copy;
+			unsigned long long seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+			copy.ns = __atomic_load_n(&e->ns, __ATOMIC_RELAXED);
+			copy.session = __atomic_load_n(&e->session, __ATOMIC_RELAXED);
+			copy.event = __atomic_load_n(&e->event, __ATOMIC_RELAXED);
+			copy.arg = __atomic_load_n(&e->arg, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			/* skip entries being written or already overwritten */
+			if (seq != i + 1 || __atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq ||
+				copy.event < 0 || copy.event >= TR_EVENTS)
+				continue;
+			if (sizeof o->buf - o->len < 128)
+				flush(o);
+			o->len += snprintf(o->buf + o->len, sizeof o->buf - o->len,
+							   "{\"t\":%llu,\"s\":%u,\"e\":\"%s\",\"a\":", copy.ns,
+							   copy.session, event_names[copy.event]);
+			if (copy.event == TR_CLOSE && copy.arg >= 0 && copy.arg < TC_REASONS)
+				o->len += snprintf(o->buf + o->len, sizeof o->buf - o->len,
+								   "\"%s\"}\n", close_names[copy.arg]);
+			else
+				o->len += snprintf(o->buf + o->len, sizeof o->buf - o->len, "%d}\n", copy.arg);
+		}
+	}
+	flush(o);
+	free(o);
+}
@@ -0,0 +1,54 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+//RcB: DEP "trace.c"
+
+/* flight recorder for the lifecycle of sessions. every event is stamped
+   with the monotonic clock into a ring of the calling thread, a coroutine
+   worker or session thread. the rings are written without locks and
+   overwrite their oldest entries, so recording is always on and a dump
+   shows the recent past. the dump is one json object per line:
+
+     {"t":NANOSECONDS,"s":SESSION,"e":"EVENT","a":ARG}
+
+   trace-report.sh turns it into a breakdown of the slowest sessions.
+   the accept event is taken when accept() returns, time spent in the
+   kernel's listen queue before that is not visible. */
+
+enum trace_event
+{
+	TR_ACCEPT,		  /* accept() returned the connection */
+	TR_START,		  /* session thread or coroutine runs */
+	TR_METHOD,		  /* method selected, arg is the method */
+	TR_AUTH,		  /* credentials checked, arg is 0 if they are good */
+	TR_RESOLVE_START,
+	TR_RESOLVE_END,	  /* arg is the getaddrinfo() result */
+	TR_CONNECT_START,
+	TR_CONNECT_END,	  /* arg is 0 or the errno of the failure */
+	TR_FIRST_UP,	  /* first byte from the client relayed */
+	TR_FIRST_DOWN,	  /* first byte from the target relayed */
+	TR_CLOSE,		  /* arg is an enum trace_close */
+	TR_EVENTS,
+};
+
+enum trace_close
+{
+	TC_CLIENT,	 /* client went away or misbehaved during the handshake */
+	TC_REJECTED, /* request denied or the target could not be reached */
+	TC_EOF,		 /* both sides closed the tunnel */
+	TC_IDLE,	 /* reaped after the idle timeout */
+	TC_ERROR,	 /* read or write error on the tunnel */
+	TC_NOMEM,	 /* out of relay buffers */
+	TC_REASONS,
+};
+
+/* entries per thread ring, rounded up to a power of 2, 0 turns the
+   recorder off. returns 0 on success. */
+int trace_config(unsigned entries);
+/* a new session id */
+unsigned trace_session(void);
+void trace(unsigned session, enum trace_event ev, int arg);
+/* all recorded events, ordered by ring and time */
+void trace_dump(int fd);
+
+#endif
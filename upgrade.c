@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+#include "upgrade.h"
+#include "server.h"
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+union fdmsg
+{
+	struct cmsghdr h;
+	char buf[CMSG_SPACE(sizeof(int) * UPGRADE_MAX_FDS)];
+};
+
+int upgrade_inherit(const char *path, int *fds, int max, int *ctlfd)
+{
+	struct sockaddr_un sun;
+	socklen_t len = unix_addr(&sun, path);
+	int n, fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (!len || fd == -1)
+		return -1;
+	if (connect(fd, (void *)&sun, len) == -1)
+	{
+		n = errno;
+		close(fd);
+		errno = n;
+		return (n == ENOENT || n == ECONNREFUSED) ? 0 : -1;
+	}
+	char byte;
+	union fdmsg ctl;
+	struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = ctl.buf,
+		.msg_controllen = sizeof ctl.buf,
+	};
+	struct cmsghdr *c;
+	if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) != 1 || !(c = CMSG_FIRSTHDR(&msg)) ||
+		c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+	{
+		close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+	n = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	if (n > max)
+		n = max;
+	memcpy(fds, CMSG_DATA(c), n * sizeof(int));
+	*ctlfd = fd;
+	return n;
+}
+
+int upgrade_ack(int ctlfd)
+{
+	int ret = write(ctlfd, "k", 1) == 1 ? 0 : -1;
+	close(ctlfd);
+	return ret;
+}
+
+int upgrade_listen(const char *path)
+{
+	/* whoever can connect here can take over our listening sockets,
+	   upgrade_handover() checks the peer as well */
+	return unix_listen(path, 1, 0600);
+}
+
+int upgrade_handover(int ctlfd, const int *fds, int n)
+{
+	int ret = -1, fd = accept4(ctlfd, 0, 0, SOCK_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	if (!unix_peer_ours(fd))
+	{
+		close(fd);
+		errno = EPERM;
+		return -1;
+	}
+	char byte = 'u';
+	union fdmsg ctl;
+	struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = ctl.buf,
+		.msg_controllen = CMSG_SPACE(n * sizeof(int)),
+	};
+	memset(&ctl, 0, sizeof ctl);
+	struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(n * sizeof(int));
+	memcpy(CMSG_DATA(c), fds, n * sizeof(int));
+	struct pollfd p = {.fd = fd, .events = POLLIN};
+	/* the new instance may die before it took over, so don't wait forever */
+	if (sendmsg(fd, &msg, 0) == 1 && poll(&p, 1, 10000) == 1 &&
+		read(fd, &byte, 1) == 1 && byte == 'k')
+		ret = 0;
+	close(fd);
+	return ret;
+}
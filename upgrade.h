@@ -0,0 +1,27 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+//RcB: DEP "upgrade.c"
+
+/* hot upgrade: a running instance listens on a unix socket, a newly
+   started instance connects to it and receives the listening sockets
+   via SCM_RIGHTS. the old instance then stops accepting and drains its
+   sessions, while the new one accepts from the very same sockets, so no
+   connection attempt is refused in between.
+   paths starting with '@' denote abstract sockets. */
+
+#define UPGRADE_MAX_FDS 16
+
+/* receive the listening sockets from the instance serving path.
+   returns the number of fds stored in fds, 0 if no instance is running,
+   or -1 on error. on success the caller has to upgrade_ack() once it has
+   taken over, which makes the old instance stop accepting. */
+int upgrade_inherit(const char *path, int *fds, int max, int *ctlfd);
+int upgrade_ack(int ctlfd);
+/* bind the control socket path, replacing a stale one. returns its fd. */
+int upgrade_listen(const char *path);
+/* serve one upgrade request on the control socket ctlfd: hand over
+   the n fds and wait for the acknowledgement. returns 0 on success. */
+int upgrade_handover(int ctlfd, const int *fds, int n);
+
+#endif
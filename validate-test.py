@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+# replays the jobs of stratum.json through a proxy with local share checks:
+#   ./microsocks -p 1080 -W 8,validate & ./validate-test.py 1080
+# a pool of its own on 127.0.0.1 hands out the transcript's first job at a
+# low difficulty, a miner mines shares for it and submits them through the
+# proxy, which has to answer the stale, duplicate and low ones itself with
+# 21, 22 and 23 and pass everything else to the pool. the second job comes
+# with clean_jobs in two writes. with split the miner writes its lines in
+# small pieces, which the proxy only inspects on the pool's port:
+#   ./microsocks -p 1081 -W 8,validate -I stratum:3333 &
+#   ./validate-test.py 1081 3333 split
+# exits nonzero if any submit went the wrong way.
+import hashlib, json, os, re, socket, struct, sys, threading, time
+
+EN1, DIFF, MASK = '64650100e6bdbb', 0.00002, 0x1fffe000
+
+def transcript():
+	path = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'stratum.json')
+	objs, dec = [], json.JSONDecoder()
+	for part in re.split(r'^//.*$', open(path).read(), flags=re.M):
+		s = part.strip()
+		while s:
+			o, i = dec.raw_decode(s)
+			objs.append(o)
+			s = s[i:].strip()
+	return [o for o in objs if o.get('method') == 'mining.notify']
+
+def sha256d(b):
+	return hashlib.sha256(hashlib.sha256(b).digest()).digest()
+
+def line(o):
+	return json.dumps(o).encode() + b'\n'
+
+def notify(job):
+	n = dict(job)
+	n['params'] = list(n['params'])
+	n['params'][8] = True
+	return line(n)
+
+def pool(ls, jobs, seen):
+	c, _ = ls.accept()
+	for l in c.makefile('rb'):
+		m = json.loads(l)
+		reply = {'id': m['id'], 'result': True, 'error': None}
+		if m['method'] == 'mining.configure':
+			reply['result'] = {'version-rolling': True, 'version-rolling.mask': '%08x' % MASK}
+		elif m['method'] == 'mining.subscribe':
+			reply['result'] = [[['mining.set_difficulty', '1'], ['mining.notify', '1']], EN1, 4]
+		elif m['method'] == 'mining.submit':
+			seen.add(m['id'])
+		elif m['method'] == 'newblock':
+			b = notify(jobs[1])
+			c.sendall(b[:700])
+			time.sleep(0.05)
+			c.sendall(b[700:])
+			continue
+		c.sendall(line(reply))
+		if m['method'] == 'mining.authorize':
+			c.sendall(line({'id': None, 'method': 'mining.set_difficulty', 'params': [DIFF]}))
+			c.sendall(notify(jobs[0]))
+
+def header(j, en2, nonce, vb=None):
+	root = sha256d(bytes.fromhex(j[2] + EN1 + en2 + j[3]))
+	for b in j[4]:
+		root = sha256d(root + bytes.fromhex(b))
+	ver = int(j[5], 16)
+	if vb is not None:
+		ver = (ver & ~MASK) | (vb & MASK)
+	prev = bytes.fromhex(j[1])
+	prev = b''.join(prev[i:i + 4][::-1] for i in range(0, 32, 4))
+	return struct.pack('<I', ver) + prev + root + struct.pack('<III', int(j[7], 16), int(j[6], 16), nonce)
+
+def mine(j, en2, vb=None, low=False):
+	base = header(j, en2, 0, vb)[:76]
+	for nonce in range(1 << 32):
+		diff = 0xffff * 2**208 / int.from_bytes(sha256d(base + struct.pack('<I', nonce)), 'little')
+		if (diff >= DIFF) != low:
+			return nonce
+
+class Miner:
+	def __init__(self, proxy, port, split):
+		self.s = socket.create_connection(('127.0.0.1', proxy), timeout=10)
+		self.s.sendall(b'\5\1\0')
+		self.s.recv(2)
+		self.s.sendall(b'\5\1\0\1' + socket.inet_aton('127.0.0.1') + struct.pack('>H', port))
+		r = self.s.recv(10)
+		if len(r) < 2 or r[1] != 0:
+			sys.exit('the proxy refused the tunnel')
+		self.s.settimeout(None)
+		self.split, self.job, self.replies = split, None, {}
+		threading.Thread(target=self.read, daemon=True).start()
+
+	def read(self):
+		for l in self.s.makefile('rb'):
+			m = json.loads(l)
+			if m.get('method') == 'mining.notify':
+				self.job = m['params']
+			elif m.get('id') is not None:
+				self.replies[m['id']] = m
+
+	def send(self, o):
+		b = line(o)
+		if not self.split:
+			return self.s.sendall(b)
+		for i in range(0, len(b), 7):
+			self.s.sendall(b[i:i + 7])
+			time.sleep(0.0003)
+
+	def submit(self, id, job, en2, nonce, vb=None):
+		params = ['w1', job[0], en2, job[7], '%08x' % nonce]
+		self.send({'id': id, 'method': 'mining.submit', 'params': params + (['%08x' % vb] if vb is not None else [])})
+
+def main():
+	if len(sys.argv) < 2:
+		sys.exit('usage: %s proxyport [poolport] [split]' % sys.argv[0])
+	jobs, seen = transcript(), set()
+	ls = socket.socket()
+	ls.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+	ls.bind(('127.0.0.1', int(sys.argv[2]) if len(sys.argv) > 2 else 0))
+	ls.listen(4)
+	threading.Thread(target=pool, args=(ls, jobs, seen), daemon=True).start()
+	m = Miner(int(sys.argv[1]), ls.getsockname()[1], sys.argv[3:] == ['split'])
+	m.send({'id': 1, 'method': 'mining.configure', 'params': [['version-rolling'], {'version-rolling.mask': 'ffffffff'}]})
+	m.send({'id': 2, 'method': 'mining.subscribe', 'params': ['validate-test']})
+	m.send({'id': 3, 'method': 'mining.authorize', 'params': ['w1', 'x']})
+	for i in range(500):
+		if m.job:
+			break
+		time.sleep(0.01)
+	else:
+		sys.exit('no job from the pool')
+	j = m.job
+	good = mine(j, '00000001')
+	cases = [
+		(10, 'valid', None, lambda: m.submit(10, j, '00000001', good)),
+		(11, 'duplicate', 22, lambda: m.submit(11, j, '00000001', good)),
+		(12, 'low', 23, lambda: m.submit(12, j, '00000002', mine(j, '00000002', low=True))),
+		(13, 'valid, rolled', None, lambda: m.submit(13, j, '00000003', mine(j, '00000003', 0x00400000), 0x00400000)),
+		(14, 'low, rolled', 23, lambda: m.submit(14, j, '00000004', mine(j, '00000004', 0x00800000, True), 0x00800000)),
+		(15, 'unchecked extranonce2', None, lambda: m.submit(15, j, '0000000304', good)),
+		(16, 'stale', 21, lambda: (m.send({'id': 9, 'method': 'newblock', 'params': []}), time.sleep(0.5),
+								   m.submit(16, j, '00000005', good))),
+		(17, 'unknown job', None, lambda: m.submit(17, ['nope'] + j[1:], '00000001', good)),
+	]
+	for case in cases:
+		case[3]()
+	time.sleep(0.5)
+	failed = 0
+	for id, what, code, _ in cases:
+		err = m.replies.get(id, {}).get('error')
+		got = 'pool' if id in seen else err[0] if err else None
+		want = 'pool' if code is None else code
+		failed += got != want
+		print('%-22s %-5s %s' % (what, got, 'ok' if got == want else 'expected %s' % want))
+	sys.exit(1 if failed else 0)
+
+main()